@@ -8,7 +8,49 @@
 #include <chrono>
 
 #include <queue>   // added for task 3
+#include <array>   // lookup tables for 3x3 morphology
+#include <thread>  // parallel_for
+#include <condition_variable> // thread pool
+#include <functional>
+#include <exception>
+#include <limits>
+#include <cstdint>
+#include <map>     // fft tables cache
+#include <mutex>
+#include <memory>
+#include <atomic>  // thread pool
+#include <new>
+#include <cstdlib>
+#include <fstream> // fft wisdom file
+#include <tuple>
 #include <complex> // added for task 4
+#include <type_traits>
+#include <sstream> // filter bank file
+#include <cstdio>
+#include <cstring>
+#include <cctype>  // ppm header
+#include <deque>
+#include <filesystem> // batch directories
+
+// memory mapped files (spectrum cache)
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// fft butterflies (float, and double in the column pass) and prefetching with AVX2 and FMA
+// (when the compiler targets them, e.g. -mavx2 -mfma or /arch:AVX2)
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#define DMIMG_AVX2
+#include <immintrin.h>
+#endif
 
 
 #include "CLI11.hpp"
@@ -23,6 +65,156 @@ namespace dmimg {
 		throw std::runtime_error(s);
 	}
 	using namespace cimg_library;
+	// fixed set of worker threads, started once and reused by every parallel_for
+	// the thread which calls run() works on the tasks too
+	class Thread_pool {
+	public:
+		explicit Thread_pool(int threads_count) {
+			for (int i = 1; i < threads_count; i++) {
+				workers_.emplace_back([this]() { work(); });
+			}
+		}
+		~Thread_pool() {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+			wake_.notify_all();
+			for (auto& worker : workers_) worker.join();
+		}
+		Thread_pool(const Thread_pool&) = delete;
+		Thread_pool& operator=(const Thread_pool&) = delete;
+
+		int size() const { return static_cast<int>(workers_.size()) + 1; }
+
+		// runs task(i) for every i in [0, tasks_count) and returns when all of them are done
+		// the first exception thrown by a task is rethrown here
+		// called from inside a task it runs everything on the calling thread
+		void run(int tasks_count, const std::function<void(int)>& task) {
+			if (workers_.empty() or tasks_count <= 1 or inside_task()) {
+				for (int i = 0; i < tasks_count; i++) task(i);
+				return;
+			}
+			// one job at a time
+			std::lock_guard<std::mutex> run_lock(run_mutex_);
+			Job job(task, tasks_count);
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				job_ = &job;
+				generation_++;
+			}
+			wake_.notify_all();
+			execute(job);
+			std::unique_lock<std::mutex> lock(mutex_);
+			// no new helpers, wait for the ones still working
+			job_ = nullptr;
+			done_.wait(lock, [&]() { return job.finished == job.tasks_count and job.helpers == 0; });
+			if (job.error) std::rethrow_exception(job.error);
+		}
+
+	private:
+		struct Job {
+			Job(const std::function<void(int)>& task, int tasks_count) : task(task), tasks_count(tasks_count) {}
+			const std::function<void(int)>& task;
+			const int tasks_count;
+			std::atomic<int> next_task{ 0 };
+			// guarded by mutex_
+			int finished = 0;
+			int helpers = 0;
+			std::exception_ptr error;
+		};
+
+		static bool& inside_task() {
+			thread_local bool inside = false;
+			return inside;
+		}
+
+		void execute(Job& job) {
+			bool was_inside = inside_task();
+			inside_task() = true;
+			for (int i = job.next_task++; i < job.tasks_count; i = job.next_task++) {
+				std::exception_ptr error;
+				try {
+					job.task(i);
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (error and !job.error) job.error = error;
+				if (++job.finished == job.tasks_count) done_.notify_all();
+			}
+			inside_task() = was_inside;
+		}
+
+		void work() {
+			long long seen_generation = 0;
+			std::unique_lock<std::mutex> lock(mutex_);
+			while (true) {
+				wake_.wait(lock, [&]() { return stopping_ or (job_ != nullptr and generation_ != seen_generation); });
+				if (stopping_) return;
+				seen_generation = generation_;
+				Job* job = job_;
+				job->helpers++;
+				lock.unlock();
+				execute(*job);
+				lock.lock();
+				job->helpers--;
+				done_.notify_all();
+			}
+		}
+
+		std::vector<std::thread> workers_;
+		std::mutex run_mutex_;
+		std::mutex mutex_;
+		std::condition_variable wake_;
+		std::condition_variable done_;
+		Job* job_ = nullptr;
+		long long generation_ = 0;
+		bool stopping_ = false;
+	};
+
+	int default_threads_count() {
+		return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	}
+
+	std::mutex thread_pool_mutex;
+	std::unique_ptr<Thread_pool> thread_pool_instance;
+
+	// the pool used by parallel_for, created with the first use
+	Thread_pool& thread_pool() {
+		std::lock_guard<std::mutex> lock(thread_pool_mutex);
+		if (!thread_pool_instance) thread_pool_instance = std::make_unique<Thread_pool>(dmimg::default_threads_count());
+		return *thread_pool_instance;
+	}
+
+	// restarts the pool with the given number of threads (0 = one per hardware thread)
+	// must not be called while parallel_for runs
+	void set_threads_count(int threads_count) {
+		std::lock_guard<std::mutex> lock(thread_pool_mutex);
+		if (threads_count <= 0) threads_count = dmimg::default_threads_count();
+		thread_pool_instance.reset();
+		thread_pool_instance = std::make_unique<Thread_pool>(threads_count);
+	}
+
+	// splits [begin, end) into equal chunks (one per thread of the pool) and runs
+	// body(chunk_begin, chunk_end) for each of them in parallel, every chunk must write only
+	// to its own part of the data, so the result does not depend on the number of threads
+	template <class Function>
+	void parallel_for(int begin, int end, Function body) {
+		Thread_pool& pool = dmimg::thread_pool();
+		int chunks_count = std::min(pool.size(), end - begin);
+		if (chunks_count <= 1) {
+			if (begin < end) body(begin, end);
+			return;
+		}
+		int chunk = (end - begin + chunks_count - 1) / chunks_count;
+		chunks_count = (end - begin + chunk - 1) / chunk;
+		pool.run(chunks_count, [&](int i) {
+			int chunk_begin = begin + i * chunk;
+			body(chunk_begin, std::min(chunk_begin + chunk, end));
+		});
+	}
 	// get image width
 	template <class T>
 	inline int width(const CImg<T>& img) {
@@ -974,11 +1166,11 @@ namespace dmimg {
 		}
 		return true;
 	}
-	// M5 task variant
+	// M5 task variant - NON-optimized version, one hmt per structural element
 	// N(A,B) = A - (A HMT with B)
 	//			img - img_cpy
 	template <class T>
-	void m5(CImg<T>& img) {
+	void m5_slow(CImg<T>& img) {
 		CImg<T> img_beginning = img;
 		CImg<T> img_cpy = img;
 
@@ -1010,6 +1202,510 @@ namespace dmimg {
 		}
 	}
 
+	// lookup-table engine for 3x3 binary operations
+	// every 3x3 neighbourhood of a b&w image can be written as a 9-bit code:
+	// bit (x2 + 1) * 3 + (y2 + 1) is set when pixel (x + x2, y + y2) is a foreground pixel
+	// so any 3x3 operation can be precompiled into a table of 512 answers
+	// columns occupy 3 consecutive bits, so moving one pixel to the right is code >> 3
+	using hmt_lut = std::array<bool, 512>;
+
+	// true if the neighbourhood described by code is hit by the structural element
+	// (same rules as in hmt: FG must be FG, BG must be BG, GR does not matter)
+	inline bool hmt_lut_hits(int code, const std::vector<xyval>& structural_el) {
+		for (const xyval& el : structural_el) {
+			bool is_fg = (code >> ((el.x + 1) * 3 + (el.y + 1))) & 1;
+			if (el.value == FG and !is_fg) return false;
+			if (el.value == BG and is_fg) return false;
+		}
+		return true;
+	}
+
+	// hmt with the union of the given structural elements
+	hmt_lut compile_hmt_lut(const std::vector<std::vector<xyval>>& structural_els) {
+		for (const auto& structural_el : structural_els) {
+			for (const xyval& el : structural_el) {
+				if (el.x < -1 or el.x > 1 or el.y < -1 or el.y > 1) dmimg::error("lookup table: structural element must fit in a 3x3 grid");
+			}
+		}
+		hmt_lut lut = {};
+		for (int code = 0; code < 512; code++) {
+			for (const auto& structural_el : structural_els) {
+				if (dmimg::hmt_lut_hits(code, structural_el)) {
+					lut[code] = true;
+					break;
+				}
+			}
+		}
+		return lut;
+	}
+
+	// A - (A HMT with B1 u B2 u ...)
+	hmt_lut compile_thinning_lut(const std::vector<std::vector<xyval>>& structural_els) {
+		hmt_lut lut = dmimg::compile_hmt_lut(structural_els);
+		// bit 4 is the middle pixel
+		for (int code = 0; code < 512; code++) {
+			lut[code] = ((code >> 4) & 1) and !lut[code];
+		}
+		return lut;
+	}
+
+	// A u (A HMT with B1 u B2 u ...)
+	hmt_lut compile_thickening_lut(const std::vector<std::vector<xyval>>& structural_els) {
+		hmt_lut lut = dmimg::compile_hmt_lut(structural_els);
+		for (int code = 0; code < 512; code++) {
+			lut[code] = ((code >> 4) & 1) or lut[code];
+		}
+		return lut;
+	}
+
+	// applies a precompiled table to every pixel EXCEPT the very border
+	// returns true if any pixel has changed
+	template <class T>
+	bool apply_hmt_lut(CImg<T>& img, const hmt_lut& lut) {
+		int width = dmimg::width(img);
+		int height = dmimg::height(img);
+		if (width < 3 or height < 3) return false;
+		// foreground mask of the source, the image itself is modified on the fly
+		std::vector<unsigned char> fg(width * height);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				fg[y * width + x] = dmimg::get_r(img, x, y) == FG;
+			}
+		}
+		bool changed = false;
+		for (int y = 1; y < height - 1; y++) {
+			const unsigned char* above = &fg[(y - 1) * width];
+			const unsigned char* middle = &fg[y * width];
+			const unsigned char* below = &fg[(y + 1) * width];
+			// first two columns, the third one is shifted in at the beginning of the loop
+			int code = ((above[0] | (middle[0] << 1) | (below[0] << 2)) << 3) |
+				((above[1] | (middle[1] << 1) | (below[1] << 2)) << 6);
+			for (int x = 1; x < width - 1; x++) {
+				code = (code >> 3) | ((above[x + 1] | (middle[x + 1] << 1) | (below[x + 1] << 2)) << 6);
+				int value = lut[code] ? FG : BG;
+				if (dmimg::get_r(img, x, y) != value) changed = true;
+				dmimg::set_rgb(img, x, y, value);
+			}
+		}
+		return changed;
+	}
+
+	// HMT with the union of several structural elements in one pass
+	template <class T>
+	void hmt_union(CImg<T>& img, const std::vector<std::vector<xyval>>& structural_els) {
+		dmimg::apply_hmt_lut(img, dmimg::compile_hmt_lut(structural_els));
+	}
+
+	// thinning repeated until there are no changes
+	template <class T>
+	void thinning(CImg<T>& img, const std::vector<std::vector<xyval>>& structural_els) {
+		hmt_lut lut = dmimg::compile_thinning_lut(structural_els);
+		while (dmimg::apply_hmt_lut(img, lut));
+	}
+
+	// thickening repeated until there are no changes
+	template <class T>
+	void thickening(CImg<T>& img, const std::vector<std::vector<xyval>>& structural_els) {
+		hmt_lut lut = dmimg::compile_thickening_lut(structural_els);
+		while (dmimg::apply_hmt_lut(img, lut));
+	}
+
+	// M5 task variant
+	// all 8 structural elements are subtracted from the same source image
+	// so one iteration is a single thinning pass with their union
+	template <class T>
+	void m5(CImg<T>& img) {
+		std::vector<std::vector<xyval>> structural_els;
+		// xii are <15, 22>
+		for (int s = 0; s < 8; s++) {
+			structural_els.push_back(dmimg::get_structural_element(15 + s));
+		}
+		dmimg::thinning(img, structural_els);
+	}
+
+	// exact Euclidean distance transform (Felzenszwalb & Huttenlocher)
+	// the squared distance is separable: first 1D transform of every row
+	// and then 1D transform of every column of the result, both are O(n)
+	// value used for pixels that have no target pixel at all
+	const long long edt_infinity = std::numeric_limits<long long>::max();
+
+	// 1D squared distance transform of f (lower envelope of parabolas)
+	// v, z and d are scratch buffers of at least n, n + 1 and n elements
+	inline void distance_transform_1D(double* f, int n, int* v, double* z, double* d) {
+		const double inf = 1e20;
+		int k = 0;
+		v[0] = 0;
+		z[0] = -inf;
+		z[1] = inf;
+		for (int q = 1; q < n; q++) {
+			double s = ((f[q] + double(q) * q) - (f[v[k]] + double(v[k]) * v[k])) / (2.0 * q - 2.0 * v[k]);
+			while (s <= z[k]) {
+				k--;
+				s = ((f[q] + double(q) * q) - (f[v[k]] + double(v[k]) * v[k])) / (2.0 * q - 2.0 * v[k]);
+			}
+			k++;
+			v[k] = q;
+			z[k] = s;
+			z[k + 1] = inf;
+		}
+		k = 0;
+		for (int q = 0; q < n; q++) {
+			while (z[k + 1] < q) k++;
+			d[q] = double(q - v[k]) * (q - v[k]) + f[v[k]];
+		}
+		for (int q = 0; q < n; q++) f[q] = d[q];
+	}
+
+	// squared distance of every pixel to the nearest pixel of value target (FG by default)
+	// returned array is indexed [y * width + x], pixels with no target get edt_infinity
+	template <class T>
+	std::vector<long long> squared_distance_transform(CImg<T>& img, int target = FG) {
+		const int width = dmimg::width(img);
+		const int height = dmimg::height(img);
+		const double inf = 1e20;
+		std::vector<double> distance(static_cast<size_t>(width) * height);
+		// rows
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			std::vector<int> v(width);
+			std::vector<double> z(width + 1), d(width);
+			for (int y = y_begin; y < y_end; y++) {
+				double* row = &distance[static_cast<size_t>(y) * width];
+				for (int x = 0; x < width; x++) {
+					row[x] = (dmimg::get_r(img, x, y) == target) ? 0.0 : inf;
+				}
+				dmimg::distance_transform_1D(row, width, v.data(), z.data(), d.data());
+			}
+			});
+		// columns
+		dmimg::parallel_for(0, width, [&](int x_begin, int x_end) {
+			std::vector<int> v(height);
+			std::vector<double> z(height + 1), d(height), column(height);
+			for (int x = x_begin; x < x_end; x++) {
+				for (int y = 0; y < height; y++) column[y] = distance[static_cast<size_t>(y) * width + x];
+				dmimg::distance_transform_1D(column.data(), height, v.data(), z.data(), d.data());
+				for (int y = 0; y < height; y++) distance[static_cast<size_t>(y) * width + x] = column[y];
+			}
+			});
+		// all the finite values are integers which double represents exactly
+		std::vector<long long> output(distance.size());
+		for (size_t i = 0; i < distance.size(); i++) {
+			output[i] = (distance[i] >= inf / 2) ? edt_infinity : static_cast<long long>(distance[i]);
+		}
+		return output;
+	}
+
+	// Euclidean distance of every pixel to the nearest pixel of value target (FG by default)
+	// pixels with no target get infinity
+	template <class T>
+	std::vector<float> distance_transform(CImg<T>& img, int target = FG) {
+		std::vector<long long> squared = dmimg::squared_distance_transform(img, target);
+		std::vector<float> output(squared.size());
+		for (size_t i = 0; i < squared.size(); i++) {
+			output[i] = (squared[i] == edt_infinity) ? std::numeric_limits<float>::infinity() : std::sqrt(static_cast<float>(squared[i]));
+		}
+		return output;
+	}
+
+	// distance map as an image, scaled so that the largest finite distance is white
+	template <class T>
+	void distance_transform_image(CImg<T>& img) {
+		std::vector<float> distance = dmimg::distance_transform(img);
+		float max_distance = 0;
+		for (float d : distance) {
+			if (d != std::numeric_limits<float>::infinity() and d > max_distance) max_distance = d;
+		}
+		float scale = (max_distance > 0) ? 255.0f / max_distance : 0.0f;
+		for (int y = 0; y < dmimg::height(img); y++) {
+			for (int x = 0; x < dmimg::width(img); x++) {
+				float d = distance[static_cast<size_t>(y) * dmimg::width(img) + x];
+				dmimg::set_rgb_safe(img, x, y, (d == std::numeric_limits<float>::infinity()) ? 255 : int(d * scale));
+			}
+		}
+	}
+
+	// erosion with a disk of given radius
+	// pixel stays foreground if the nearest background pixel is further than radius
+	template <class T>
+	void erosion_disk(CImg<T>& img, int radius) {
+		if (radius < 0) dmimg::error("erosion: radius can't be negative");
+		std::vector<long long> distance = dmimg::squared_distance_transform(img, BG);
+		const long long radius_squared = static_cast<long long>(radius) * radius;
+		for (int y = 0; y < dmimg::height(img); y++) {
+			for (int x = 0; x < dmimg::width(img); x++) {
+				bool is_fg = distance[static_cast<size_t>(y) * dmimg::width(img) + x] > radius_squared;
+				dmimg::set_rgb(img, x, y, is_fg ? FG : BG);
+			}
+		}
+	}
+
+	// dilation with a disk of given radius
+	// pixel becomes foreground if the nearest foreground pixel is within radius
+	template <class T>
+	void dilation_disk(CImg<T>& img, int radius) {
+		if (radius < 0) dmimg::error("dilation: radius can't be negative");
+		std::vector<long long> distance = dmimg::squared_distance_transform(img, FG);
+		const long long radius_squared = static_cast<long long>(radius) * radius;
+		for (int y = 0; y < dmimg::height(img); y++) {
+			for (int x = 0; x < dmimg::width(img); x++) {
+				bool is_fg = distance[static_cast<size_t>(y) * dmimg::width(img) + x] <= radius_squared;
+				dmimg::set_rgb(img, x, y, is_fg ? FG : BG);
+			}
+		}
+	}
+
+	// morphological reconstruction (Vincent's hybrid algorithm)
+	// works on planes of gray values indexed [y * width + x] and uses 8-connectivity
+	// b&w images are converted so that foreground pixels are 255 and background 0
+	template <class T>
+	std::vector<unsigned char> gray_plane(CImg<T>& img) {
+		std::vector<unsigned char> plane(static_cast<size_t>(dmimg::width(img)) * dmimg::height(img));
+		for (int y = 0; y < dmimg::height(img); y++) {
+			for (int x = 0; x < dmimg::width(img); x++) {
+				plane[static_cast<size_t>(y) * dmimg::width(img) + x] = dmimg::get_r(img, x, y);
+			}
+		}
+		return plane;
+	}
+
+	template <class T>
+	std::vector<unsigned char> fg_plane(CImg<T>& img) {
+		std::vector<unsigned char> plane(static_cast<size_t>(dmimg::width(img)) * dmimg::height(img));
+		for (int y = 0; y < dmimg::height(img); y++) {
+			for (int x = 0; x < dmimg::width(img); x++) {
+				plane[static_cast<size_t>(y) * dmimg::width(img) + x] = (dmimg::get_r(img, x, y) == FG) ? 255 : 0;
+			}
+		}
+		return plane;
+	}
+
+	template <class T>
+	void set_gray_plane(CImg<T>& img, const std::vector<unsigned char>& plane) {
+		for (int y = 0; y < dmimg::height(img); y++) {
+			for (int x = 0; x < dmimg::width(img); x++) {
+				dmimg::set_rgb(img, x, y, plane[static_cast<size_t>(y) * dmimg::width(img) + x]);
+			}
+		}
+	}
+
+	template <class T>
+	void set_fg_plane(CImg<T>& img, const std::vector<unsigned char>& plane) {
+		for (int y = 0; y < dmimg::height(img); y++) {
+			for (int x = 0; x < dmimg::width(img); x++) {
+				dmimg::set_rgb(img, x, y, plane[static_cast<size_t>(y) * dmimg::width(img) + x] ? FG : BG);
+			}
+		}
+	}
+
+	// reconstruction by dilation of marker under mask, the result is written into marker
+	// 1. raster scan and anti-raster scan propagate values in the two main directions
+	// 2. pixels that can still propagate something are put into a FIFO queue
+	//    which is emptied, so every pixel is processed only a few times
+	void reconstruction_by_dilation(std::vector<unsigned char>& marker, const std::vector<unsigned char>& mask, int width, int height) {
+		if (marker.size() != mask.size()) dmimg::error("reconstruction: the sizes of marker and mask are not equal");
+		// marker must lie under the mask
+		for (size_t i = 0; i < marker.size(); i++) {
+			marker[i] = std::min(marker[i], mask[i]);
+		}
+		// raster scan - neighbours above and to the left
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				int p = y * width + x;
+				unsigned char value = marker[p];
+				if (x > 0) value = std::max(value, marker[p - 1]);
+				if (y > 0) {
+					if (x > 0) value = std::max(value, marker[p - width - 1]);
+					value = std::max(value, marker[p - width]);
+					if (x < width - 1) value = std::max(value, marker[p - width + 1]);
+				}
+				marker[p] = std::min(value, mask[p]);
+			}
+		}
+		// anti-raster scan - neighbours below and to the right
+		std::queue<int> fifo;
+		for (int y = height - 1; y >= 0; y--) {
+			for (int x = width - 1; x >= 0; x--) {
+				int p = y * width + x;
+				unsigned char value = marker[p];
+				if (x < width - 1) value = std::max(value, marker[p + 1]);
+				if (y < height - 1) {
+					if (x < width - 1) value = std::max(value, marker[p + width + 1]);
+					value = std::max(value, marker[p + width]);
+					if (x > 0) value = std::max(value, marker[p + width - 1]);
+				}
+				value = std::min(value, mask[p]);
+				marker[p] = value;
+				// check if p can still propagate into one of those neighbours
+				bool propagates = false;
+				if (x < width - 1) {
+					int q = p + 1;
+					propagates = propagates or (marker[q] < value and marker[q] < mask[q]);
+				}
+				if (y < height - 1) {
+					int q = p + width;
+					propagates = propagates or (marker[q] < value and marker[q] < mask[q]);
+					if (x < width - 1) {
+						q = p + width + 1;
+						propagates = propagates or (marker[q] < value and marker[q] < mask[q]);
+					}
+					if (x > 0) {
+						q = p + width - 1;
+						propagates = propagates or (marker[q] < value and marker[q] < mask[q]);
+					}
+				}
+				if (propagates) fifo.push(p);
+			}
+		}
+		// propagation
+		while (!fifo.empty()) {
+			int p = fifo.front();
+			fifo.pop();
+			int x = p % width;
+			int y = p / width;
+			for (int y2 = -1; y2 <= 1; y2++) {
+				for (int x2 = -1; x2 <= 1; x2++) {
+					if (x2 == 0 and y2 == 0) continue;
+					if (x + x2 < 0 or x + x2 >= width or y + y2 < 0 or y + y2 >= height) continue;
+					int q = p + y2 * width + x2;
+					if (marker[q] < marker[p] and mask[q] != marker[q]) {
+						marker[q] = std::min(marker[p], mask[q]);
+						fifo.push(q);
+					}
+				}
+			}
+		}
+	}
+
+	// reconstruction by erosion of marker over mask, marker must be >= mask
+	void reconstruction_by_erosion(std::vector<unsigned char>& marker, const std::vector<unsigned char>& mask, int width, int height) {
+		std::vector<unsigned char> mask_complement(mask.size());
+		for (size_t i = 0; i < mask.size(); i++) {
+			marker[i] = 255 - marker[i];
+			mask_complement[i] = 255 - mask[i];
+		}
+		dmimg::reconstruction_by_dilation(marker, mask_complement, width, height);
+		for (size_t i = 0; i < marker.size(); i++) {
+			marker[i] = 255 - marker[i];
+		}
+	}
+
+	// grayscale reconstruction, values are taken from the red channel, result is written into marker
+	template <class T>
+	void reconstruction(CImg<T>& marker, CImg<T>& mask) {
+		if (!((marker.width() == mask.width()) && (marker.height() == mask.height()))) {
+			dmimg::error("reconstruction: the sizes of marker and mask are not equal");
+		}
+		std::vector<unsigned char> marker_plane = dmimg::gray_plane(marker);
+		dmimg::reconstruction_by_dilation(marker_plane, dmimg::gray_plane(mask), marker.width(), marker.height());
+		dmimg::set_gray_plane(marker, marker_plane);
+	}
+
+	// b&w reconstruction, foreground objects of mask which are touched by the marker are kept
+	template <class T>
+	void reconstruction_bw(CImg<T>& marker, CImg<T>& mask) {
+		if (!((marker.width() == mask.width()) && (marker.height() == mask.height()))) {
+			dmimg::error("reconstruction: the sizes of marker and mask are not equal");
+		}
+		std::vector<unsigned char> marker_plane = dmimg::fg_plane(marker);
+		dmimg::reconstruction_by_dilation(marker_plane, dmimg::fg_plane(mask), marker.width(), marker.height());
+		dmimg::set_fg_plane(marker, marker_plane);
+	}
+
+	// fills all the regions that can't be reached from the border of the image
+	// plane is modified in place (works for b&w planes and gray values)
+	void fill_holes(std::vector<unsigned char>& plane, int width, int height) {
+		// complement of the image with marker set on the border
+		std::vector<unsigned char> complement(plane.size());
+		std::vector<unsigned char> marker(plane.size(), 0);
+		for (size_t i = 0; i < plane.size(); i++) complement[i] = 255 - plane[i];
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				if (x == 0 or y == 0 or x == width - 1 or y == height - 1) marker[y * width + x] = complement[y * width + x];
+			}
+		}
+		dmimg::reconstruction_by_dilation(marker, complement, width, height);
+		for (size_t i = 0; i < plane.size(); i++) plane[i] = 255 - marker[i];
+	}
+
+	// removes all the objects which touch the border of the image
+	void clear_border(std::vector<unsigned char>& plane, int width, int height) {
+		std::vector<unsigned char> marker(plane.size(), 0);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				if (x == 0 or y == 0 or x == width - 1 or y == height - 1) marker[y * width + x] = plane[y * width + x];
+			}
+		}
+		dmimg::reconstruction_by_dilation(marker, plane, width, height);
+		for (size_t i = 0; i < plane.size(); i++) plane[i] = plane[i] - marker[i];
+	}
+
+	// h-domes: f - reconstruction of (f - h) under f
+	void h_domes(std::vector<unsigned char>& plane, int width, int height, int h) {
+		if (h < 0 or h > 255) dmimg::error("h-domes: h must be between 0 and 255");
+		std::vector<unsigned char> marker(plane.size());
+		for (size_t i = 0; i < plane.size(); i++) marker[i] = std::max(0, plane[i] - h);
+		dmimg::reconstruction_by_dilation(marker, plane, width, height);
+		for (size_t i = 0; i < plane.size(); i++) plane[i] = plane[i] - marker[i];
+	}
+
+	// regional maxima: plateaus with no higher neighbours, 255 for maxima and 0 elsewhere
+	// computed as f - reconstruction of (f - 1) under f
+	// f - 1 saturates at 0, so a plateau at 0 is missed; such a plateau has only higher
+	// neighbours and is a maximum only when it covers the whole (constant) image
+	void regional_maxima(std::vector<unsigned char>& plane, int width, int height) {
+		if (std::all_of(plane.begin(), plane.end(), [&](unsigned char value) { return value == plane[0]; })) {
+			std::fill(plane.begin(), plane.end(), 255);
+			return;
+		}
+		dmimg::h_domes(plane, width, height, 1);
+		for (size_t i = 0; i < plane.size(); i++) plane[i] = plane[i] ? 255 : 0;
+	}
+
+	// regional minima: regional maxima of the complement
+	void regional_minima(std::vector<unsigned char>& plane, int width, int height) {
+		for (size_t i = 0; i < plane.size(); i++) plane[i] = 255 - plane[i];
+		dmimg::regional_maxima(plane, width, height);
+	}
+
+	// b&w hole filling
+	template <class T>
+	void fill_holes(CImg<T>& img) {
+		std::vector<unsigned char> plane = dmimg::fg_plane(img);
+		dmimg::fill_holes(plane, img.width(), img.height());
+		dmimg::set_fg_plane(img, plane);
+	}
+
+	// b&w border objects removal
+	template <class T>
+	void clear_border(CImg<T>& img) {
+		std::vector<unsigned char> plane = dmimg::fg_plane(img);
+		dmimg::clear_border(plane, img.width(), img.height());
+		dmimg::set_fg_plane(img, plane);
+	}
+
+	// grayscale h-domes, output is the height of the domes
+	template <class T>
+	void h_domes(CImg<T>& img, int h) {
+		std::vector<unsigned char> plane = dmimg::gray_plane(img);
+		dmimg::h_domes(plane, img.width(), img.height(), h);
+		dmimg::set_gray_plane(img, plane);
+	}
+
+	// grayscale regional maxima, output is b&w with maxima as foreground
+	template <class T>
+	void regional_maxima(CImg<T>& img) {
+		std::vector<unsigned char> plane = dmimg::gray_plane(img);
+		dmimg::regional_maxima(plane, img.width(), img.height());
+		dmimg::set_fg_plane(img, plane);
+	}
+
+	// grayscale regional minima, output is b&w with minima as foreground
+	template <class T>
+	void regional_minima(CImg<T>& img) {
+		std::vector<unsigned char> plane = dmimg::gray_plane(img);
+		dmimg::regional_minima(plane, img.width(), img.height());
+		dmimg::set_fg_plane(img, plane);
+	}
+
 	// R1 region growing (merging)
 	struct Coordinates {
 		int x;
@@ -1061,8 +1757,9 @@ namespace dmimg {
 		return valid_pixels;
 	}
 
+	// NON-optimized version of region growing
 	template <class T>
-	void perform_merging(CImg<T>& img, int seedX, int seedY, int threshold) {
+	void perform_merging_slow(CImg<T>& img, int seedX, int seedY, int threshold) {
 		CImg<T> img_copy = img;
 		std::queue<Coordinates> seed_points; // FIFO, first-in, first-out, like in the store
 		std::vector<Coordinates> surrounding_pixels;
@@ -1082,525 +1779,4181 @@ namespace dmimg {
 
 		img = img_copy;
 	}
-	// ######################################################################
-	// TASK 4
-	// fft
-	using std::shared_ptr;
-	using std::vector;
-	using std::complex;
 
-	constexpr float value_pi = 3.14159265358979323846; // approximate value of PI
-	constexpr double value_pi_double = 3.141592653589793238460; // approximate value of PI
-	// just check limits not to go over
-	int check_value(int value) {
-		if (value < 0) return 0;
-		if (value > 255) return 255;
+	// one bit per pixel, 64 pixels in one word
+	struct Bit_mask {
+		std::vector<std::uint64_t> words;
 
-		return value;
-	}
+		Bit_mask(size_t size) : words((size + 63) / 64, 0) {}
 
-	template <class T>
-	std::vector<std::vector<std::complex<double>>>& perform_slow_normal_descrete_fourier_transform(CImg<T>& original) {
-		auto* output = new std::vector<std::vector<std::complex<double>>>;
-		std::vector<std::vector<std::complex<double>>> temp;
-		
-		for (int y = 0; y < original.height(); y++) {
-			std::vector<std::complex<double>> row; // before loop
-			temp.push_back(row);
-			for (int x = 0; x < original.width(); x++) {
-				std::complex<double> sum = (0.0, 0.0);
-				for (int xx = 0; xx < original.width(); xx++) {
-					std::complex<double> W(cos(2 * value_pi * xx * x / original.width()), -sin(2 * value_pi * xx * x / original.width()));
-					sum += static_cast<double>(original(y,xx))* W; // 
-				}
-				temp[y].push_back(sum);
-			}
+		bool get(size_t i) const {
+			return (words[i >> 6] >> (i & 63)) & 1;
 		}
-		
-		for (int x = 0; x < original.width(); x++) {
-			std::vector<std::complex<double>> col;
-			(*output).push_back(col);
-			for (int y = 0; y < original.height(); y++) {
-				std::complex<double> sum = (0.0, 0.0);
-				for (int yy = 0; yy < original.height(); yy++) {
-					std::complex<double> W(cos(2 * value_pi * yy * y / original.height()), -sin(2 * value_pi * yy * y / original.height()));
-					sum += temp[yy][x] * W;
-				}
-				(*output)[x].push_back(sum);
-			}
+		void set(size_t i) {
+			words[i >> 6] |= std::uint64_t(1) << (i & 63);
 		}
+	};
 
-		return *output;
-	}
+	// the largest distance of two rgb colours is sqrt(3) * 255 < 442, higher thresholds
+	// accept everything and are clamped to it (so that the square doesn't overflow)
+	const int max_colour_distance = 442;
 
-	CImg<unsigned char>& perform_slow_inversed__descrete_fourier_transform(std::vector<std::vector<std::complex<double>>>& original) {
-		auto* output = new CImg<unsigned char>(original[0].size(), original.size(), 1, 3, 0);
-		std::vector<std::vector<std::complex<double>>> temp;
+	// optimized region growing - scanline flood fill
+	// the region is the same as in perform_merging_slow: 8-connected pixels within threshold
+	// of the seed colour, pixels which are already red (255, 0, 0) are treated as processed
+	// instead of single pixels whole horizontal spans are filled at once and only one
+	// pixel per span of the rows above and below is put on the stack
+	template <class T>
+	void perform_merging(CImg<T>& img, int seedX, int seedY, int threshold) {
+		const int width = dmimg::width(img);
+		const int height = dmimg::height(img);
+		if (seedX < 0 or seedX >= width or seedY < 0 or seedY >= height) dmimg::error("Region merging: seed is outside of the image");
+		// nothing can be within negative threshold, not even the seed
+		if (threshold < 0) return;
+
+		const int seed_r = dmimg::get_r(img, seedX, seedY);
+		const int seed_g = dmimg::get_g(img, seedX, seedY);
+		const int seed_b = dmimg::get_b(img, seedX, seedY);
+		threshold = std::min(threshold, max_colour_distance);
+		const int threshold_squared = threshold * threshold;
+		// the image itself is coloured on the fly, colours are read only from pixels not visited yet
+		Bit_mask visited(static_cast<size_t>(width) * height);
+		// can pixel be added to the region
+		auto accepts = [&](int x, int y) {
+			if (visited.get(static_cast<size_t>(y) * width + x)) return false;
+			int r = dmimg::get_r(img, x, y);
+			int g = dmimg::get_g(img, x, y);
+			int b = dmimg::get_b(img, x, y);
+			if (r == 255 and g == 0 and b == 0) return false;
+			int distance_squared = (r - seed_r) * (r - seed_r) + (g - seed_g) * (g - seed_g) + (b - seed_b) * (b - seed_b);
+			return distance_squared <= threshold_squared;
+		};
 
-		for (int x = 0; x < (*output).width(); x++) {
-			std::vector<std::complex<double>> col;
-			temp.push_back(col);
-			for (int y = 0; y < (*output).height(); y++) {
-				std::complex<double> sum = (0.0, 0.0);
-				for (int yy = 0; yy < (*output).height(); yy++) {
-					std::complex<double> comp(cos(2 * value_pi * yy * y / (*output).height()), sin(2 * value_pi * yy * y / (*output).height()));
-					sum += original[x][yy] * comp;
+		std::vector<Coordinates> stack;
+		stack.reserve(static_cast<size_t>(width) + height);
+		if (accepts(seedX, seedY)) {
+			stack.push_back({ seedX, seedY });
+		}
+		else {
+			// the seed is red already, it is not coloured but it still spreads to the neighbours
+			for (int y = std::max(seedY - 1, 0); y <= std::min(seedY + 1, height - 1); y++) {
+				for (int x = std::max(seedX - 1, 0); x <= std::min(seedX + 1, width - 1); x++) {
+					stack.push_back({ x, y });
 				}
-				temp[x].push_back(sum / (double)(*output).height());
 			}
 		}
 
-		for (int y = 0; y < (*output).height(); y++) {
-			std::vector<std::complex<double>> row;
-			temp.push_back(row);
-			for (int x = 0; x < (*output).width(); x++) {
-				std::complex<double> sum = (0.0, 0.0);
-				for (int xx = 0; xx < (*output).width(); xx++) {
-					std::complex<double> comp(cos(2 * value_pi * xx * x / (*output).width()), sin(2 * value_pi * xx * x / (*output).height()));
-					sum += temp[xx][y] * comp;
-				}
-				for (int c = 0; c < 3; c++) {
-					(*output)(y, x, c) = dmimg::check_value(abs(sum) / original.size());
+		while (!stack.empty()) {
+			Coordinates pixel = stack.back();
+			stack.pop_back();
+			if (!accepts(pixel.x, pixel.y)) continue;
+			// find the whole span in this row
+			int left = pixel.x;
+			int right = pixel.x;
+			while (left > 0 and accepts(left - 1, pixel.y)) left--;
+			while (right < width - 1 and accepts(right + 1, pixel.y)) right++;
+			for (int x = left; x <= right; x++) {
+				visited.set(static_cast<size_t>(pixel.y) * width + x);
+				dmimg::color_red(img, x, pixel.y);
+			}
+			// one seed for every span in the rows above and below (diagonals included)
+			for (int y = pixel.y - 1; y <= pixel.y + 1; y += 2) {
+				if (y < 0 or y >= height) continue;
+				bool in_span = false;
+				for (int x = std::max(left - 1, 0); x <= std::min(right + 1, width - 1); x++) {
+					if (accepts(x, y)) {
+						if (!in_span) stack.push_back({ x, y });
+						in_span = true;
+					}
+					else {
+						in_span = false;
+					}
 				}
 			}
 		}
+	}
+	// full image segmentation - connected component labeling
+	// every pixel gets a label, neighbouring (8-connectivity) pixels that are similar share it
+	// the image is cut into horizontal strips which are labeled in parallel with union-find,
+	// afterwards the equivalences across the seams between strips are merged
+
+	// statistics of one labeled region
+	struct Region_stats {
+		long long area;
+		int x_min;
+		int y_min;
+		int x_max;
+		int y_max;
+		double mean_r;
+		double mean_g;
+		double mean_b;
+	};
 
-		return *output;
+	// union-find over pixel indexes, roots are always the smallest index of the set
+	inline std::uint32_t find_root(std::vector<std::uint32_t>& parent, std::uint32_t i) {
+		while (parent[i] != i) {
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
 	}
 
-	std::vector<std::vector<std::complex<double>>>& swap_quarters(std::vector<std::vector<std::complex<double>>>& original) {
-		auto* output = new std::vector<std::vector<std::complex<double>>>;
+	inline void unite(std::vector<std::uint32_t>& parent, std::uint32_t a, std::uint32_t b) {
+		a = dmimg::find_root(parent, a);
+		b = dmimg::find_root(parent, b);
+		if (a < b) parent[b] = a;
+		else if (b < a) parent[a] = b;
+	}
 
-		for (int x = 0; x < original.size(); x++) {
-			std::vector<std::complex<double>> column;
-			for (int y = 0; y < original.size(); y++) {
-				column.push_back(original[x][y]);
+	// labels are written into labels (1 channel, 32-bit), numbered from 1 in raster order
+	// similar(x1, y1, x2, y2) decides if two neighbouring pixels belong to the same region
+	// returned vector is indexed by label, element 0 is not used
+	template <class T, class Predicate>
+	std::vector<Region_stats> label_regions(CImg<T>& img, CImg<std::uint32_t>& labels, Predicate similar) {
+		const int width = dmimg::width(img);
+		const int height = dmimg::height(img);
+		labels.assign(width, height, 1, 1, 0);
+		if (width == 0 or height == 0) return std::vector<Region_stats>(1, Region_stats{});
+		if (static_cast<double>(width) * height >= std::numeric_limits<std::uint32_t>::max()) dmimg::error("labeling: image is too big");
+		std::vector<std::uint32_t> parent(static_cast<size_t>(width) * height);
+		for (size_t i = 0; i < parent.size(); i++) parent[i] = static_cast<std::uint32_t>(i);
+
+		// every strip only links pixels inside of it, so threads never touch the same entries
+		int strips = std::max(1, std::min(height, static_cast<int>(std::thread::hardware_concurrency())));
+		int strip_height = (height + strips - 1) / strips;
+		auto link_with_row_above = [&](int x, int y) {
+			std::uint32_t p = static_cast<std::uint32_t>(y) * width + x;
+			for (int x2 = x - 1; x2 <= x + 1; x2++) {
+				if (x2 < 0 or x2 >= width) continue;
+				if (similar(x, y, x2, y - 1)) dmimg::unite(parent, p, p - width + (x2 - x));
+			}
+		};
+		dmimg::parallel_for(0, strips, [&](int strip_begin, int strip_end) {
+			for (int strip = strip_begin; strip < strip_end; strip++) {
+				int y_begin = strip * strip_height;
+				int y_end = std::min(y_begin + strip_height, height);
+				for (int y = y_begin; y < y_end; y++) {
+					for (int x = 0; x < width; x++) {
+						std::uint32_t p = static_cast<std::uint32_t>(y) * width + x;
+						if (x > 0 and similar(x, y, x - 1, y)) dmimg::unite(parent, p, p - 1);
+						if (y > y_begin) link_with_row_above(x, y);
+					}
+				}
 			}
-			(*output).push_back(column); column.clear();
+			});
+		// seams
+		for (int y = strip_height; y < height; y += strip_height) {
+			for (int x = 0; x < width; x++) link_with_row_above(x, y);
 		}
 
-		for (int x = 0; x < original.size() / 2; x++) {
-			for (int y = 0; y < original[0].size() / 2; y++) {
-				std::swap((*output)[x][y], (*output)[original.size() / 2 + x][original[0].size() / 2 + y]);
-				std::swap((*output)[original.size() / 2 + x][y], (*output)[x][original[0].size() / 2 + y]);
+		// final labels and statistics in one pass, the root always comes before the rest of the set
+		std::vector<Region_stats> stats(1, Region_stats{});
+		std::vector<double> sum_r(1), sum_g(1), sum_b(1);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				std::uint32_t p = static_cast<std::uint32_t>(y) * width + x;
+				std::uint32_t root = dmimg::find_root(parent, p);
+				std::uint32_t label;
+				if (root == p) {
+					label = static_cast<std::uint32_t>(stats.size());
+					stats.push_back({ 0, x, y, x, y, 0, 0, 0 });
+					sum_r.push_back(0);
+					sum_g.push_back(0);
+					sum_b.push_back(0);
+				}
+				else {
+					label = labels(root % width, root / width);
+				}
+				labels(x, y) = label;
+				Region_stats& region = stats[label];
+				region.area++;
+				region.x_min = std::min(region.x_min, x);
+				region.x_max = std::max(region.x_max, x);
+				region.y_max = y;
+				sum_r[label] += dmimg::get_r(img, x, y);
+				sum_g[label] += dmimg::get_g(img, x, y);
+				sum_b[label] += dmimg::get_b(img, x, y);
 			}
 		}
-
-		return *output;
+		for (size_t label = 1; label < stats.size(); label++) {
+			stats[label].mean_r = sum_r[label] / stats[label].area;
+			stats[label].mean_g = sum_g[label] / stats[label].area;
+			stats[label].mean_b = sum_b[label] / stats[label].area;
+		}
+		return stats;
 	}
 
+	// neighbouring pixels are similar if their colours are within threshold
+	template <class T>
+	std::vector<Region_stats> label_regions(CImg<T>& img, CImg<std::uint32_t>& labels, int threshold) {
+		const int threshold_squared = std::min(threshold, max_colour_distance) * std::min(threshold, max_colour_distance);
+		return dmimg::label_regions(img, labels, [&](int x1, int y1, int x2, int y2) {
+			int r = dmimg::get_r(img, x1, y1) - dmimg::get_r(img, x2, y2);
+			int g = dmimg::get_g(img, x1, y1) - dmimg::get_g(img, x2, y2);
+			int b = dmimg::get_b(img, x1, y1) - dmimg::get_b(img, x2, y2);
+			return threshold >= 0 and r * r + g * g + b * b <= threshold_squared;
+			});
+	}
 
-	CImg<unsigned char>& visualisation_image(std::vector<std::vector<std::complex<double>>>& original) { // only for vis.
-		// this will be created on heap so deletion is required afterwards, at the end of the program
-		// smart pointer may be used
-		auto* output = new CImg<unsigned char>(original[0].size(), original.size(), 1, 3, 0);
+	// b&w images - neighbouring pixels are similar if they are equal
+	template <class T>
+	std::vector<Region_stats> label_regions_bw(CImg<T>& img, CImg<std::uint32_t>& labels) {
+		return dmimg::label_regions(img, labels, [&](int x1, int y1, int x2, int y2) {
+			return dmimg::get_r(img, x1, y1) == dmimg::get_r(img, x2, y2);
+			});
+	}
 
-		for (int x = 0; x < original[0].size(); x++) {
-			for (int y = 0; y < original.size(); y++) {
-				for (int c = 0; c < 3; c++) {
-					(*output)(x, y, c) = dmimg::check_value(log(abs(original[y][x])) * 15.0); // magnitude spect.
-				}
+	// paints every region with its mean colour
+	template <class T>
+	void paint_regions(CImg<T>& img, CImg<std::uint32_t>& labels, const std::vector<Region_stats>& stats) {
+		for (int y = 0; y < dmimg::height(img); y++) {
+			for (int x = 0; x < dmimg::width(img); x++) {
+				const Region_stats& region = stats[labels(x, y)];
+				dmimg::set_rgb_color(img, x, y, int(region.mean_r + 0.5), int(region.mean_g + 0.5), int(region.mean_b + 0.5));
 			}
 		}
-
-		return *output;
 	}
 
-	CImg<unsigned char> image_from_complex(vector<vector<complex<double>>>& original) {
-		CImg<unsigned char> output(original[0].size(), original.size(), 1, 3, 0);
+	// watershed segmentation (priority-flood)
+	// the relief is flooded from the markers, lowest level first, every unlabeled pixel takes
+	// the label of the neighbour which floods it, levels are 8-bit so the priority queue is
+	// 256 FIFO buckets and every pixel is pushed and popped exactly once
 
-		for (int x = 0; x < original[0].size(); x++) {
-			for (int y = 0; y < original.size(); y++) {
-				for (int c = 0; c < 3; c++) {
-					output(x, y, c) = dmimg::check_value(log(abs(original[y][x])) * 15.0); // magnitude spect.
+	// morphological gradient (max - min in 3x3 neighbourhood) of the red channel
+	template <class T>
+	std::vector<unsigned char> morphological_gradient(CImg<T>& img) {
+		const int width = dmimg::width(img);
+		const int height = dmimg::height(img);
+		std::vector<unsigned char> gradient(static_cast<size_t>(width) * height);
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				for (int x = 0; x < width; x++) {
+					int min_value = 255;
+					int max_value = 0;
+					for (int y2 = std::max(y - 1, 0); y2 <= std::min(y + 1, height - 1); y2++) {
+						for (int x2 = std::max(x - 1, 0); x2 <= std::min(x + 1, width - 1); x2++) {
+							int value = dmimg::get_r(img, x2, y2);
+							min_value = std::min(min_value, value);
+							max_value = std::max(max_value, value);
+						}
+					}
+					gradient[static_cast<size_t>(y) * width + x] = max_value - min_value;
 				}
 			}
+			});
+		return gradient;
+	}
+
+	// labels every foreground object of b&w marker image, background gets 0
+	// (labels are unique but not consecutive)
+	template <class T>
+	void markers_from_bw(CImg<T>& marker, CImg<std::uint32_t>& labels) {
+		dmimg::label_regions_bw(marker, labels);
+		for (int y = 0; y < dmimg::height(marker); y++) {
+			for (int x = 0; x < dmimg::width(marker); x++) {
+				if (dmimg::get_r(marker, x, y) != FG) labels(x, y) = 0;
+			}
+		}
+	}
+
+	// labels contains the markers (non zero) on input and the labels of all the basins on output
+	// pixels which can't be reached from any marker stay 0
+	void watershed(const std::vector<unsigned char>& relief, CImg<std::uint32_t>& labels) {
+		const int width = labels.width();
+		const int height = labels.height();
+		if (relief.size() != static_cast<size_t>(width) * height) dmimg::error("watershed: the sizes of relief and markers are not equal");
+		std::vector<std::vector<std::uint32_t>> buckets(256);
+		std::uint32_t* label = labels.data();
+		for (size_t p = 0; p < relief.size(); p++) {
+			if (label[p] != 0) buckets[relief[p]].push_back(static_cast<std::uint32_t>(p));
+		}
+		// offsets of the 8 neighbours, border pixels check the coordinates
+		const std::int64_t offsets[8] = { -width - 1, -width, -width + 1, -1, 1, width - 1, width, width + 1 };
+		const int offset_x[8] = { -1, 0, 1, -1, 1, -1, 0, 1 };
+		const int offset_y[8] = { -1, -1, -1, 0, 0, 1, 1, 1 };
+		for (int level = 0; level < 256; level++) {
+			// the bucket can grow while it is processed, pixels are never pushed below the current level
+			for (size_t i = 0; i < buckets[level].size(); i++) {
+				std::uint32_t p = buckets[level][i];
+				int y = p / width;
+				int x = p - y * width;
+				bool inside = x > 0 and y > 0 and x < width - 1 and y < height - 1;
+				for (int n = 0; n < 8; n++) {
+					if (!inside) {
+						int x2 = x + offset_x[n];
+						int y2 = y + offset_y[n];
+						if (x2 < 0 or y2 < 0 or x2 >= width or y2 >= height) continue;
+					}
+					std::uint32_t q = static_cast<std::uint32_t>(p + offsets[n]);
+					if (label[q] != 0) continue;
+					label[q] = label[p];
+					buckets[std::max(int(relief[q]), level)].push_back(q);
+				}
+			}
+			// release memory of finished levels
+			std::vector<std::uint32_t>().swap(buckets[level]);
+		}
+	}
+
+	// watershed of the morphological gradient of img
+	// markers are the foreground objects of b&w marker image
+	// or regional minima of the gradient if no marker image is given
+	template <class T>
+	void watershed(CImg<T>& img, CImg<std::uint32_t>& labels, CImg<T>* marker = nullptr) {
+		std::vector<unsigned char> gradient = dmimg::morphological_gradient(img);
+		if (marker != nullptr) {
+			if (!((marker->width() == img.width()) && (marker->height() == img.height()))) {
+				dmimg::error("watershed: the sizes of the image and the markers are not equal");
+			}
+			dmimg::markers_from_bw(*marker, labels);
+		}
+		else {
+			std::vector<unsigned char> minima = gradient;
+			dmimg::regional_minima(minima, img.width(), img.height());
+			CImg<T> minima_img(img.width(), img.height(), 1, 3);
+			dmimg::set_fg_plane(minima_img, minima);
+			dmimg::markers_from_bw(minima_img, labels);
+		}
+		dmimg::watershed(gradient, labels);
+	}
+
+	// draws borders between the regions in red
+	template <class T>
+	void draw_region_borders(CImg<T>& img, CImg<std::uint32_t>& labels) {
+		for (int y = 0; y < dmimg::height(img); y++) {
+			for (int x = 0; x < dmimg::width(img); x++) {
+				bool border = (x + 1 < dmimg::width(img) and labels(x, y) != labels(x + 1, y)) or
+					(y + 1 < dmimg::height(img) and labels(x, y) != labels(x, y + 1));
+				if (border) dmimg::set_rgb_color(img, x, y, 255, 0, 0);
+			}
+		}
+	}
+
+	// ######################################################################
+	// TASK 4
+	// fft
+	using std::shared_ptr;
+	using std::vector;
+	using std::complex;
+
+	constexpr float value_pi = 3.14159265358979323846; // approximate value of PI
+	constexpr double value_pi_double = 3.141592653589793238460; // approximate value of PI
+	// view of one column of a complex matrix
+	template <class Real>
+	struct Basic_column_view {
+		complex<Real>* data;
+		int size;
+		int stride;
+
+		complex<Real>& operator[](int i) const {
+			return data[static_cast<size_t>(i) * stride];
+		}
+	};
+
+	// 2D array of complex numbers (Real is double or float) in a single 64-byte aligned block, rows one after another
+	// it can be moved but not copied, clone() makes a deep copy when it is really needed
+	template <class Real>
+	class Basic_complex_matrix {
+	public:
+		static constexpr std::uintptr_t alignment = 64;
+
+		Basic_complex_matrix() {}
+		// all the elements are set to 0
+		Basic_complex_matrix(int width, int height) : width_(width), height_(height) {
+			if (width < 0 or height < 0) dmimg::error("complex matrix: size can't be negative");
+			raw_ = static_cast<char*>(::operator new(sizeof(complex<Real>) * size() + alignment));
+			data_ = reinterpret_cast<complex<Real>*>((reinterpret_cast<std::uintptr_t>(raw_) + alignment - 1) & ~(alignment - 1));
+			std::uninitialized_fill(data_, data_ + size(), complex<Real>(0.0, 0.0));
+		}
+		Basic_complex_matrix(const Basic_complex_matrix&) = delete;
+		Basic_complex_matrix& operator=(const Basic_complex_matrix&) = delete;
+		Basic_complex_matrix(Basic_complex_matrix&& other) noexcept {
+			swap(other);
+		}
+		Basic_complex_matrix& operator=(Basic_complex_matrix&& other) noexcept {
+			Basic_complex_matrix(std::move(other)).swap(*this);
+			return *this;
+		}
+		~Basic_complex_matrix() {
+			::operator delete(raw_);
+		}
+
+		void swap(Basic_complex_matrix& other) noexcept {
+			std::swap(width_, other.width_);
+			std::swap(height_, other.height_);
+			std::swap(raw_, other.raw_);
+			std::swap(data_, other.data_);
+		}
+		Basic_complex_matrix clone() const {
+			Basic_complex_matrix copy(width_, height_);
+			std::copy(data_, data_ + size(), copy.data_);
+			return copy;
+		}
+
+		int width() const { return width_; }
+		int height() const { return height_; }
+		size_t size() const { return static_cast<size_t>(width_) * height_; }
+		complex<Real>* data() { return data_; }
+		const complex<Real>* data() const { return data_; }
+		complex<Real>& operator()(int x, int y) { return data_[static_cast<size_t>(y) * width_ + x]; }
+		const complex<Real>& operator()(int x, int y) const { return data_[static_cast<size_t>(y) * width_ + x]; }
+		// contiguous row
+		complex<Real>* row(int y) { return data_ + static_cast<size_t>(y) * width_; }
+		const complex<Real>* row(int y) const { return data_ + static_cast<size_t>(y) * width_; }
+		// column, every width-th element
+		Basic_column_view<Real> column(int x) { return { data_ + x, height_, width_ }; }
+
+	private:
+		int width_ = 0;
+		int height_ = 0;
+		char* raw_ = nullptr;
+		complex<Real>* data_ = nullptr;
+	};
+
+	// double gives exact 8-bit results with a big margin, float is enough for them too:
+	// half of the memory traffic and twice as many numbers in a SIMD register
+	using Complex_matrix = Basic_complex_matrix<double>;
+	using Complex_matrix_float = Basic_complex_matrix<float>;
+	using Column_view = Basic_column_view<double>;
+
+	// just check limits not to go over
+	int check_value(int value) {
+		if (value < 0) return 0;
+		if (value > 255) return 255;
+
+		return value;
+	}
+
+	// direct dft, any size
+	// the exponent of e^(-2 pi i * u * x / n) only matters mod n, so the n values
+	// e^(-2 pi i * k / n) are computed once and every term is a table lookup (no cos and sin)
+
+	// table[k] = e^(-2 pi i * k / n) (inverse: e^(2 pi i * k / n))
+	vector<complex<double>> dft_table(int size, bool inverse = false) {
+		vector<complex<double>> table(size);
+		for (int k = 0; k < size; k++) {
+			double angle = 2 * value_pi_double * k / size;
+			table[k] = complex<double>(std::cos(angle), inverse ? std::sin(angle) : -std::sin(angle));
+		}
+		return table;
+	}
+
+	// output(u, y) = sum over x of input(x, y) * table[u * x mod width], rows in parallel
+	template <class Input>
+	void dft_rows(const Input& input, int width, int height, const vector<complex<double>>& table, Complex_matrix& output) {
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				complex<double>* output_row = output.row(y);
+				for (int u = 0; u < width; u++) {
+					complex<double> sum = 0.0;
+					int k = 0;
+					for (int x = 0; x < width; x++) {
+						sum += input(x, y) * table[k];
+						k += u;
+						if (k >= width) k -= width;
+					}
+					output_row[u] = sum;
+				}
+			}
+		});
+	}
+
+	// output(x, v) = sum over y of input(x, y) * table[v * y mod height], whole rows at a time
+	void dft_columns(const Complex_matrix& input, const vector<complex<double>>& table, Complex_matrix& output) {
+		const int width = input.width();
+		const int height = input.height();
+		dmimg::parallel_for(0, height, [&](int v_begin, int v_end) {
+			for (int v = v_begin; v < v_end; v++) {
+				complex<double>* output_row = output.row(v);
+				std::fill(output_row, output_row + width, complex<double>(0.0));
+				int k = 0;
+				for (int y = 0; y < height; y++) {
+					const complex<double> w = table[k];
+					const complex<double>* input_row = input.row(y);
+					for (int x = 0; x < width; x++) {
+						output_row[x] += input_row[x] * w;
+					}
+					k += v;
+					if (k >= height) k -= height;
+				}
+			}
+		});
+	}
+
+	// spectrum of one channel of the image (red by default), output(u, v), not centered
+	template <class T>
+	Complex_matrix dft_2D(const CImg<T>& input_img, int channel = 0) {
+		const int width = input_img.width();
+		const int height = input_img.height();
+		Complex_matrix rows(width, height);
+		dmimg::dft_rows([&](int x, int y) { return double(input_img(x, y, 0, channel)); }, width, height, dmimg::dft_table(width), rows);
+		Complex_matrix output(width, height);
+		dmimg::dft_columns(rows, dmimg::dft_table(height), output);
+		return output;
+	}
+
+	// inverse of dft_2D, the gray image of the magnitudes (rounded, as fft_inverse_2D_img)
+	CImg<unsigned char> idft_2D_img(const Complex_matrix& spectrum) {
+		const int width = spectrum.width();
+		const int height = spectrum.height();
+		Complex_matrix columns(width, height);
+		dmimg::dft_columns(spectrum, dmimg::dft_table(height, true), columns);
+		Complex_matrix samples(width, height);
+		dmimg::dft_rows([&](int x, int y) { return columns(x, y); }, width, height, dmimg::dft_table(width, true), samples);
+		CImg<unsigned char> output(width, height, 1, 3);
+		const double sizes_multiplied = double(width) * height;
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				for (int x = 0; x < width; x++) {
+					dmimg::set_rgb_safe(output, x, y, int(std::abs(samples(x, y)) / sizes_multiplied + 0.5));
+				}
+			}
+		});
+		return output;
+	}
+
+	// sparse dft: only the given (u, v) bins, with Goertzel recurrences
+	// s[n] = x[n] + 2 cos(w) * s[n - 1] - s[n - 2], X = s[N] - e^(-i w) * s[N - 1] (x[N] = 0),
+	// one multiplication by a real number per sample instead of a complex one
+	// every row is run through it for each different u (W * H), then the row results
+	// through it for each v of that u (H), so a bin costs O(W * H), not a whole transform
+
+	// bin of the sequence x[0], x[step], ... (count samples) at frequency k of n
+	template <class Value>
+	complex<double> goertzel(const Value* samples, int count, int step, int k, int n) {
+		const double angle = 2 * value_pi_double * k / n;
+		const double coefficient = 2 * std::cos(angle);
+		Value s1 = Value(0.0), s2 = Value(0.0);
+		for (int i = 0; i < count; i++) {
+			Value s0 = samples[size_t(i) * step] + coefficient * s1 - s2;
+			s2 = s1;
+			s1 = s0;
+		}
+		Value s0 = coefficient * s1 - s2;
+		return complex<double>(s0) - complex<double>(std::cos(angle), -std::sin(angle)) * complex<double>(s1);
+	}
+
+	// values of the bins (u, v) of the spectrum of one channel (red by default), the same as dft_2D(img)(u, v),
+	// u and v can be given mod the size (e.g. -1 for width - 1)
+	template <class T>
+	vector<complex<double>> dft_bins(const CImg<T>& input_img, const vector<std::pair<int, int>>& bins, int channel = 0) {
+		const int width = input_img.width();
+		const int height = input_img.height();
+		// the pixels of the channel as doubles, row by row
+		vector<double> pixels(size_t(width) * height);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				pixels[size_t(y) * width + x] = input_img(x, y, 0, channel);
+			}
+		}
+		// bins grouped by u, the rows are transformed once for every u
+		std::map<int, vector<size_t>> bins_of_u;
+		for (size_t i = 0; i < bins.size(); i++) {
+			bins_of_u[((bins[i].first % width) + width) % width].push_back(i);
+		}
+		vector<complex<double>> values(bins.size());
+		vector<complex<double>> row_values(height);
+		for (const auto& u_bins : bins_of_u) {
+			const int u = u_bins.first;
+			dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+				for (int y = y_begin; y < y_end; y++) {
+					row_values[y] = dmimg::goertzel(pixels.data() + size_t(y) * width, width, 1, u, width);
+				}
+			});
+			for (size_t i : u_bins.second) {
+				const int v = ((bins[i].second % height) + height) % height;
+				values[i] = dmimg::goertzel(row_values.data(), height, 1, v, height);
+			}
+		}
+		return values;
+	}
+
+	// spectrum as columns of rows (the old interface of --sndft), row v is the frequency v in y
+	template <class T>
+	std::vector<std::vector<std::complex<double>>> perform_slow_normal_descrete_fourier_transform(CImg<T>& original) {
+		Complex_matrix spectrum = dmimg::dft_2D(original);
+		std::vector<std::vector<std::complex<double>>> output(spectrum.height());
+		for (int v = 0; v < spectrum.height(); v++) {
+			output[v].assign(spectrum.row(v), spectrum.row(v) + spectrum.width());
+		}
+		return output;
+	}
+
+	CImg<unsigned char> perform_slow_inversed__descrete_fourier_transform(const std::vector<std::vector<std::complex<double>>>& original) {
+		Complex_matrix spectrum(original[0].size(), original.size());
+		for (int v = 0; v < spectrum.height(); v++) {
+			std::copy(original[v].begin(), original[v].end(), spectrum.row(v));
+		}
+		return dmimg::idft_2D_img(spectrum);
+	}
+
+	// changes quarters of the array of complex (zero frequency to the middle), in place
+	// element (x, y) goes to ((x + width / 2) % width, (y + height / 2) % height), also for odd sizes
+	void swap_quarters(std::vector<std::vector<std::complex<double>>>& original) {
+		if (original.empty()) return;
+		// rows are moved, not copied
+		std::rotate(original.begin(), original.begin() + (original.size() - original.size() / 2), original.end());
+		for (auto& row : original) {
+			std::rotate(row.begin(), row.begin() + (row.size() - row.size() / 2), row.end());
+		}
+	}
+
+
+	// spectrum images
+	// the gray level of an element is computed once, into one plane, and the plane is copied to the
+	// other channels; the logarithm and the angle are polynomial approximations, so the loops over
+	// a row have no calls and are vectorized
+	// magnitude: 15 * ln|X| clamped to [0, 255] (fixed, as before) or
+	// 255 * ln(1 + |X|) / ln(1 + max |X|) (automatic, the whole range of the spectrum is shown)
+	// phase: arg X from [-pi, pi] to [0, 255]
+
+	enum class Spectrum_view { magnitude, phase };
+	enum class Spectrum_scale { fixed, automatic };
+
+	// of --fft (fft_spectrum_image)
+	Spectrum_view spectrum_view_mode = Spectrum_view::magnitude;
+	Spectrum_scale spectrum_scale_mode = Spectrum_scale::fixed;
+
+	// ln x of a positive float, error below 2e-5: x = 2^e * m with m in [1, 2),
+	// ln x = (e + log2 m) * ln 2 and log2 m is a polynomial of m - 1, 0 gives about -88
+	inline float fast_log(float x) {
+		std::uint32_t bits;
+		std::memcpy(&bits, &x, sizeof(bits));
+		const float exponent = float(int((bits >> 23) & 0xff) - 127);
+		bits = (bits & 0x7fffff) | 0x3f800000;
+		float t;
+		std::memcpy(&t, &bits, sizeof(t));
+		t -= 1.0f;
+		const float log2_mantissa = 1.43909e-05f + t * (1.4415921f + t * (-0.70725343f + t * (0.41156148f + t * (-0.18983244f + t * 0.043928627f))));
+		return (exponent + log2_mantissa) * 0.69314718f;
+	}
+
+	// atan2(y, x), error below 2e-5, atan of [0, 1] is an odd polynomial and the octant is set by selects
+	inline float fast_atan2(float y, float x) {
+		const float ax = std::abs(x);
+		const float ay = std::abs(y);
+		const float t = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f);
+		const float t2 = t * t;
+		float angle = t * (0.99987874f + t2 * (-0.33040558f + t2 * (0.18041268f + t2 * (-0.085408308f + t2 * 0.020931812f))));
+		angle = (ay > ax) ? 1.5707964f - angle : angle;
+		angle = (x < 0) ? 3.1415927f - angle : angle;
+		return (y < 0) ? -angle : angle;
+	}
+
+	struct Spectrum_levels {
+		Spectrum_view view = Spectrum_view::magnitude;
+		Spectrum_scale scale = Spectrum_scale::fixed;
+		// automatic: 255 / ln(1 + max |X|)
+		float factor = 0;
+	};
+
+	Spectrum_levels spectrum_levels(Spectrum_view view, Spectrum_scale scale, double max_magnitude) {
+		Spectrum_levels levels;
+		levels.view = view;
+		levels.scale = scale;
+		levels.factor = float(255.0 / std::log1p(std::max(max_magnitude, 1e-30)));
+		return levels;
+	}
+
+	// gray levels of count values (buffer: count floats for the intermediate values)
+	template <class Real>
+	void spectrum_row_levels(const complex<Real>* values, int count, const Spectrum_levels& levels, float* buffer, unsigned char* output) {
+		const Real* parts = reinterpret_cast<const Real*>(values);
+		if (levels.view == Spectrum_view::phase) {
+			for (int i = 0; i < count; i++) {
+				buffer[i] = (dmimg::fast_atan2(float(parts[2 * i + 1]), float(parts[2 * i])) + 3.1415927f) * float(255.0 / (2 * value_pi_double));
+			}
+		}
+		else if (levels.scale == Spectrum_scale::fixed) {
+			// 15 * ln|X| = 7.5 * ln|X|^2, no square root
+			for (int i = 0; i < count; i++) {
+				float squared = float(parts[2 * i] * parts[2 * i] + parts[2 * i + 1] * parts[2 * i + 1]);
+				buffer[i] = 7.5f * dmimg::fast_log(squared);
+			}
+		}
+		else {
+			for (int i = 0; i < count; i++) {
+				float squared = float(parts[2 * i] * parts[2 * i] + parts[2 * i + 1] * parts[2 * i + 1]);
+				buffer[i] = levels.factor * dmimg::fast_log(1.0f + std::sqrt(squared));
+			}
+		}
+		for (int i = 0; i < count; i++) {
+			// truncated, as check_value(int(level)) did
+			output[i] = static_cast<unsigned char>(std::min(std::max(buffer[i], 0.0f), 255.0f));
+		}
+	}
+
+	// the first channel of the image copied to the others
+	inline void broadcast_plane(CImg<unsigned char>& img) {
+		const size_t plane_size = size_t(img.width()) * img.height();
+		for (int c = 1; c < img.spectrum(); c++) {
+			std::copy(img.data(), img.data() + plane_size, img.data(0, 0, 0, c));
+		}
+	}
+
+	// spectrum given as rows: row(y) is a pointer to width values
+	template <class Real, class Row>
+	CImg<unsigned char> spectrum_rows_image(int width, int height, Row row, const Spectrum_levels& levels) {
+		CImg<unsigned char> output(width, height, 1, 3);
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			vector<float> buffer(width);
+			for (int y = y_begin; y < y_end; y++) {
+				dmimg::spectrum_row_levels<Real>(row(y), width, levels, buffer.data(), output.data(0, y, 0, 0));
+			}
+		});
+		dmimg::broadcast_plane(output);
+		return output;
+	}
+
+	CImg<unsigned char> visualisation_image(const std::vector<std::vector<std::complex<double>>>& original) { // only for vis.
+		const Spectrum_levels levels = dmimg::spectrum_levels(Spectrum_view::magnitude, Spectrum_scale::fixed, 0);
+		return dmimg::spectrum_rows_image<double>(int(original[0].size()), int(original.size()), [&](int y) { return original[y].data(); }, levels);
+	}
+
+	template <class Real>
+	CImg<unsigned char> image_from_complex(const Basic_complex_matrix<Real>& original) {
+		const Spectrum_levels levels = dmimg::spectrum_levels(Spectrum_view::magnitude, Spectrum_scale::fixed, 0);
+		return dmimg::spectrum_rows_image<Real>(original.width(), original.height(), [&](int y) { return original.row(y); }, levels);
+	}
+
+	// helper fuction
+	template <class Real>
+	void print_complex_array(const Basic_complex_matrix<Real>& input) {
+		for (int y = 0; y < input.height(); y++) {
+			for (int x = 0; x < input.width(); x++) {
+				std::cerr << "abs: " << std::abs(input(x, y)) << " ";
+			}
+		}
+	}
+
+	bool is_power_of_two(int n)
+	{
+		return n > 0 and (n & (n - 1)) == 0;
+	}
+
+	// changes quarters of the array of complex (zero frequency to the middle), in place
+	// element (x, y) goes to ((x + width / 2) % width, (y + height / 2) % height), also for odd sizes
+	// only needed to look at a full spectrum, filters and spectrum_image index the half spectrum directly
+	template <class Real>
+	void swap_quarters_in_place(Basic_complex_matrix<Real>& original) {
+		const int width = original.width();
+		const int height = original.height();
+		if (original.size() == 0) return;
+		// rows are contiguous, so whole rows are rotated at once
+		std::rotate(original.data(), original.data() + size_t(height - height / 2) * width, original.data() + original.size());
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				std::rotate(original.row(y), original.row(y) + (width - width / 2), original.row(y) + width);
+			}
+		});
+	}
+
+	// transforms CImg image (red channel or the given one) to array of complex numbers
+	template <class Real = double, class T>
+	Basic_complex_matrix<Real> image_to_complex_matrix(CImg<T>& input_img, int channel = 0) {
+		Basic_complex_matrix<Real> output(input_img.width(), input_img.height());
+		for (int y = 0; y < input_img.height(); y++) {
+			complex<Real>* row = output.row(y);
+			for (int x = 0; x < input_img.width(); x++) {
+				row[x] = input_img(x, y, 0, channel);
+			}
+		}
+		return output;
+	}
+
+	// the same as a vector of vectors (one allocation per row)
+	template <class T>
+	shared_ptr<vector<vector<complex<double>>>> image_to_complex(CImg<T>& input_img) {
+		auto output = std::make_shared<vector<vector<complex<double>>>>();
+		for (int y = 0; y < input_img.height(); y++) {
+			vector<complex<double>> temp;
+			for (int x = 0; x < input_img.width(); x++) {
+				temp.push_back(get_r(input_img, x, y));
+			}
+			output->push_back(temp);
+		}
+		return output;
+	}
+
+	// fast Fourier transform with decimation in spatial domain
+	// we assume compatibility with grayscale images only
+	// every size has its own precomputed tables (a plan), the planner chooses the algorithm:
+	// - power of 2: iterative, in-place, bit reversal permutation and then radix-4 butterflies
+	//   (with one radix-2 stage first if log2(size) is odd)
+	// - other sizes: mixed radix with 4, 2, 3, 5 butterflies (and a general one for other primes)
+	// - sizes with large prime factors: Bluestein's algorithm, the transform is rewritten as
+	//   a convolution computed with a padded power of 2 fft
+	// mixed radix and Bluestein are chosen by the estimated number of operations
+
+	enum class Fft_algorithm { radix_4, mixed_radix, bluestein };
+
+	template <class Real> struct Basic_fft_tables;
+	template <class Real = double> const Basic_fft_tables<Real>& get_fft_tables(int size);
+	template <class Real = double> const Basic_fft_tables<Real>& get_fft_tables(int size, Fft_algorithm algorithm);
+
+	// precomputed tables for fft of one size, of complex<Real> numbers
+	// (all the values are computed in double and rounded to Real at the end)
+	template <class Real>
+	struct Basic_fft_tables {
+		int size = 0;
+		int log2_size = 0;
+		Fft_algorithm algorithm = Fft_algorithm::radix_4;
+		// twiddle factors e^(-2*pi*i*k/size) for k < size
+		vector<complex<Real>> twiddles;
+		// radix_4: index of every element after bit reversal
+		// and the twiddles of the stages with m >= 4 in the order they are used (vector butterflies):
+		// for every stage w^(k * stride), w^(2 * k * stride), w^(3 * k * stride), m of each
+		vector<int> bit_reversal;
+		vector<complex<Real>> stage_twiddles;
+		// mixed_radix: radices in the order of splitting (the last one is the first butterfly stage)
+		// and the position of every element after digit reversal
+		vector<int> factors;
+		vector<int> digit_reversal;
+		// bluestein: chirp e^(-pi*i*k^2/size) for k < size, spectrum of the convolution filter
+		// and tables of the (power of 2) convolution size
+		vector<complex<Real>> chirp;
+		vector<complex<Real>> chirp_spectrum;
+		const Basic_fft_tables* convolution_tables = nullptr;
+	};
+
+	using Fft_tables = Basic_fft_tables<double>;
+
+	// radices of size, 4 first, then 2, 3, 5, 7 and other primes
+	vector<int> fft_factors(int size) {
+		vector<int> factors;
+		while (size % 4 == 0) {
+			factors.push_back(4);
+			size /= 4;
+		}
+		for (int radix = 2; radix * radix <= size; radix++) {
+			while (size % radix == 0) {
+				factors.push_back(radix);
+				size /= radix;
+			}
+		}
+		if (size > 1) factors.push_back(size);
+		return factors;
+	}
+
+	// estimated number of operations of mixed radix fft, radices above 5 have no special butterfly
+	double mixed_radix_cost(int size, const vector<int>& factors) {
+		double cost = 0;
+		for (int radix : factors) {
+			cost += (radix <= 5) ? radix : 2.0 * radix;
+		}
+		return cost * size;
+	}
+
+	// estimated number of operations of Bluestein fft (two power of 2 transforms of convolution_size)
+	double bluestein_cost(int size, int convolution_size) {
+		int log2_size = 0;
+		while ((1 << log2_size) < convolution_size) log2_size++;
+		return 2.0 * 2.0 * convolution_size * log2_size + 6.0 * size + convolution_size;
+	}
+
+	template <class Real>
+	void fft_1D(complex<Real>* data, const Basic_fft_tables<Real>& tables, bool inverse = false);
+
+	// algorithm with the lower estimated number of operations
+	Fft_algorithm estimate_fft_algorithm(int size) {
+		if (is_power_of_two(size)) return Fft_algorithm::radix_4;
+		int convolution_size = 1;
+		while (convolution_size < 2 * size - 1) convolution_size *= 2;
+		if (dmimg::mixed_radix_cost(size, dmimg::fft_factors(size)) <= dmimg::bluestein_cost(size, convolution_size)) {
+			return Fft_algorithm::mixed_radix;
+		}
+		return Fft_algorithm::bluestein;
+	}
+
+	template <class Real>
+	Basic_fft_tables<Real> make_fft_tables(int size, Fft_algorithm algorithm) {
+		if (size < 1) dmimg::error("Can't perfrom fft of an empty array.");
+		if ((algorithm == Fft_algorithm::radix_4) != is_power_of_two(size)) dmimg::error("radix-4 fft is only for sizes that are a power of 2.");
+		Basic_fft_tables<Real> tables;
+		tables.size = size;
+		tables.algorithm = algorithm;
+		tables.twiddles.resize(size);
+		for (int k = 0; k < size; k++) {
+			tables.twiddles[k] = complex<Real>(std::polar(1.0, -2 * value_pi_double * k / size));
+		}
+		if (algorithm == Fft_algorithm::radix_4) {
+			while ((1 << tables.log2_size) < size) tables.log2_size++;
+			tables.bit_reversal.resize(size);
+			for (int i = 0; i < size; i++) {
+				int reversed = 0;
+				for (int bit = 0; bit < tables.log2_size; bit++) {
+					reversed |= ((i >> bit) & 1) << (tables.log2_size - 1 - bit);
+				}
+				tables.bit_reversal[i] = reversed;
+			}
+			for (int m = (tables.log2_size & 1) ? 2 : 1; m < size; m *= 4) {
+				if (m < 4) continue;
+				const int stride = size / (4 * m);
+				for (int q = 1; q <= 3; q++) {
+					for (int k = 0; k < m; k++) {
+						tables.stage_twiddles.push_back(tables.twiddles[q * k * stride]);
+					}
+				}
+			}
+		}
+		else if (algorithm == Fft_algorithm::mixed_radix) {
+			tables.factors = dmimg::fft_factors(size);
+			// element n goes to the block of its last digit, recursively
+			tables.digit_reversal.resize(size);
+			for (int i = 0; i < size; i++) {
+				int n = i;
+				int block_size = size;
+				int position = 0;
+				for (int radix : tables.factors) {
+					block_size /= radix;
+					position += (n % radix) * block_size;
+					n /= radix;
+				}
+				tables.digit_reversal[i] = position;
+			}
+		}
+		else {
+			int convolution_size = 1;
+			while (convolution_size < 2 * size - 1) convolution_size *= 2;
+			vector<complex<double>> chirp(size);
+			for (int k = 0; k < size; k++) {
+				// k^2 modulo 2 * size keeps the angle exact for big k
+				long long k_squared = (long long)k * k % (2LL * size);
+				chirp[k] = std::polar(1.0, -value_pi_double * k_squared / size);
+			}
+			tables.chirp.assign(chirp.begin(), chirp.end());
+			tables.convolution_tables = &dmimg::get_fft_tables<Real>(convolution_size);
+			// the spectrum of the filter is always transformed in double
+			vector<complex<double>> chirp_spectrum(convolution_size, 0.0);
+			chirp_spectrum[0] = std::conj(chirp[0]);
+			for (int k = 1; k < size; k++) {
+				chirp_spectrum[k] = std::conj(chirp[k]);
+				chirp_spectrum[convolution_size - k] = std::conj(chirp[k]);
+			}
+			dmimg::fft_1D(chirp_spectrum.data(), dmimg::get_fft_tables<double>(convolution_size));
+			// scaling of the inverse convolution transform is done here once
+			tables.chirp_spectrum.resize(convolution_size);
+			for (int k = 0; k < convolution_size; k++) {
+				tables.chirp_spectrum[k] = complex<Real>(chirp_spectrum[k] / double(convolution_size));
+			}
+		}
+		return tables;
+	}
+
+	// fft wisdom: the algorithm remembered for sizes that are not a power of 2
+	// (measured by measure_fft_algorithm or loaded with load_fft_wisdom)
+	std::map<int, Fft_algorithm> fft_wisdom;
+	std::mutex fft_wisdom_mutex;
+
+	// remembered algorithm for the size or the estimated one
+	Fft_algorithm choose_fft_algorithm(int size) {
+		if (is_power_of_two(size)) return Fft_algorithm::radix_4;
+		{
+			std::lock_guard<std::mutex> lock(fft_wisdom_mutex);
+			auto it = fft_wisdom.find(size);
+			if (it != fft_wisdom.end()) return it->second;
+		}
+		return dmimg::estimate_fft_algorithm(size);
+	}
+
+	// tables are computed once per size, algorithm and precision and shared by all the next transforms
+	// (recursive mutex, as Bluestein tables need the tables of the convolution size)
+	template <class Real>
+	const Basic_fft_tables<Real>& get_fft_tables(int size, Fft_algorithm algorithm) {
+		static std::map<std::pair<int, Fft_algorithm>, Basic_fft_tables<Real>> cache;
+		static std::recursive_mutex cache_mutex;
+		std::lock_guard<std::recursive_mutex> lock(cache_mutex);
+		auto key = std::make_pair(size, algorithm);
+		auto it = cache.find(key);
+		if (it == cache.end()) {
+			Basic_fft_tables<Real> tables = dmimg::make_fft_tables<Real>(size, algorithm);
+			it = cache.emplace(key, std::move(tables)).first;
+		}
+		return it->second;
+	}
+
+	// the fft wisdom is the same for both precisions
+	template <class Real>
+	const Basic_fft_tables<Real>& get_fft_tables(int size) {
+		return dmimg::get_fft_tables<Real>(size, dmimg::choose_fft_algorithm(size));
+	}
+
+	// complex multiplication without the inf/nan checks of std::complex operator*
+	template <class Real>
+	inline complex<Real> complex_multiply(const complex<Real>& a, const complex<Real>& b) {
+		return complex<Real>(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+	}
+
+	// float butterflies are vectorized (compiled with AVX2 and FMA)
+#ifdef DMIMG_AVX2
+	constexpr bool fft_avx2 = true;
+#else
+	constexpr bool fft_avx2 = false;
+#endif
+
+#ifdef DMIMG_AVX2
+	// AVX2 butterflies for float: a register holds 4 complex numbers (re, im, re, im, ...)
+	const __m256 avx2_negate_real = _mm256_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f);
+	const __m256 avx2_negate_imag = _mm256_setr_ps(0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f);
+
+	// (a.re * w.re - a.im * w.im, a.im * w.re + a.re * w.im) with one multiplication and one fmaddsub
+	inline __m256 complex_multiply_avx2(__m256 a, __m256 w) {
+		__m256 a_swapped = _mm256_permute_ps(a, 0xB1);
+		return _mm256_fmaddsub_ps(a, _mm256_moveldup_ps(w), _mm256_mul_ps(a_swapped, _mm256_movehdup_ps(w)));
+	}
+
+	// one butterfly of fft_radix_4 for 4 sets of a, b, c, d at once
+	// rotation_sign makes (c - d) multiplied by -i (forward) or i (inverse)
+	inline void radix_4_butterfly_avx2(float* x0, float* x1, float* x2, float* x3, __m256 w1, __m256 w2, __m256 w3, __m256 rotation_sign) {
+		__m256 a = _mm256_loadu_ps(x0);
+		__m256 b = dmimg::complex_multiply_avx2(_mm256_loadu_ps(x1), w2);
+		__m256 c = dmimg::complex_multiply_avx2(_mm256_loadu_ps(x2), w1);
+		__m256 d = dmimg::complex_multiply_avx2(_mm256_loadu_ps(x3), w3);
+		__m256 t0 = _mm256_add_ps(a, b);
+		__m256 t1 = _mm256_sub_ps(a, b);
+		__m256 t2 = _mm256_add_ps(c, d);
+		__m256 t3 = _mm256_xor_ps(_mm256_permute_ps(_mm256_sub_ps(c, d), 0xB1), rotation_sign);
+		_mm256_storeu_ps(x0, _mm256_add_ps(t0, t2));
+		_mm256_storeu_ps(x1, _mm256_add_ps(t1, t3));
+		_mm256_storeu_ps(x2, _mm256_sub_ps(t0, t2));
+		_mm256_storeu_ps(x3, _mm256_sub_ps(t1, t3));
+	}
+
+	// radix-4 stage of fft_radix_4 for m >= 4 (a multiple of 4), 4 values of k at once
+	// twiddles are the stage_twiddles of the stage, the inverse uses their conjugates
+	inline void radix_4_stage_avx2(complex<float>* data, int size, int m, const complex<float>* twiddles, bool inverse) {
+		const __m256 twiddle_sign = inverse ? avx2_negate_imag : _mm256_setzero_ps();
+		const __m256 rotation_sign = inverse ? avx2_negate_real : avx2_negate_imag;
+		const float* w = reinterpret_cast<const float*>(twiddles);
+		for (int block = 0; block < size; block += 4 * m) {
+			float* x = reinterpret_cast<float*>(data + block);
+			for (int k = 0; k < m; k += 4) {
+				__m256 w1 = _mm256_xor_ps(_mm256_loadu_ps(w + 2 * k), twiddle_sign);
+				__m256 w2 = _mm256_xor_ps(_mm256_loadu_ps(w + 2 * (m + k)), twiddle_sign);
+				__m256 w3 = _mm256_xor_ps(_mm256_loadu_ps(w + 2 * (2 * m + k)), twiddle_sign);
+				dmimg::radix_4_butterfly_avx2(x + 2 * k, x + 2 * (k + m), x + 2 * (k + 2 * m), x + 2 * (k + 3 * m), w1, w2, w3, rotation_sign);
+			}
+		}
+	}
+
+	// the same twiddle in all 4 positions of a register
+	inline __m256 broadcast_twiddle_avx2(const complex<float>& w, __m256 twiddle_sign) {
+		return _mm256_xor_ps(_mm256_castpd_ps(_mm256_broadcast_sd(reinterpret_cast<const double*>(&w))), twiddle_sign);
+	}
+
+	// the same for double, a register holds 2 complex numbers (used by the column pass)
+	const __m256d avx2_negate_real_double = _mm256_setr_pd(-0.0, 0.0, -0.0, 0.0);
+	const __m256d avx2_negate_imag_double = _mm256_setr_pd(0.0, -0.0, 0.0, -0.0);
+
+	inline __m256d complex_multiply_avx2(__m256d a, __m256d w) {
+		__m256d a_swapped = _mm256_permute_pd(a, 0x5);
+		return _mm256_fmaddsub_pd(a, _mm256_movedup_pd(w), _mm256_mul_pd(a_swapped, _mm256_permute_pd(w, 0xF)));
+	}
+
+	inline void radix_4_butterfly_avx2(double* x0, double* x1, double* x2, double* x3, __m256d w1, __m256d w2, __m256d w3, __m256d rotation_sign) {
+		__m256d a = _mm256_loadu_pd(x0);
+		__m256d b = dmimg::complex_multiply_avx2(_mm256_loadu_pd(x1), w2);
+		__m256d c = dmimg::complex_multiply_avx2(_mm256_loadu_pd(x2), w1);
+		__m256d d = dmimg::complex_multiply_avx2(_mm256_loadu_pd(x3), w3);
+		__m256d t0 = _mm256_add_pd(a, b);
+		__m256d t1 = _mm256_sub_pd(a, b);
+		__m256d t2 = _mm256_add_pd(c, d);
+		__m256d t3 = _mm256_xor_pd(_mm256_permute_pd(_mm256_sub_pd(c, d), 0x5), rotation_sign);
+		_mm256_storeu_pd(x0, _mm256_add_pd(t0, t2));
+		_mm256_storeu_pd(x1, _mm256_add_pd(t1, t3));
+		_mm256_storeu_pd(x2, _mm256_sub_pd(t0, t2));
+		_mm256_storeu_pd(x3, _mm256_sub_pd(t1, t3));
+	}
+
+	inline __m256d broadcast_twiddle_avx2(const complex<double>& w, __m256d twiddle_sign) {
+		return _mm256_xor_pd(_mm256_broadcast_pd(reinterpret_cast<const __m128d*>(&w)), twiddle_sign);
+	}
+
+	// registers of float or double complex numbers: their count and the sign masks of the butterflies
+	template <class Real> struct Avx2_complex;
+	template <> struct Avx2_complex<float> {
+		static constexpr int count = 4;
+		static __m256 no_sign() { return _mm256_setzero_ps(); }
+		static __m256 negate_real() { return avx2_negate_real; }
+		static __m256 negate_imag() { return avx2_negate_imag; }
+	};
+	template <> struct Avx2_complex<double> {
+		static constexpr int count = 2;
+		static __m256d no_sign() { return _mm256_setzero_pd(); }
+		static __m256d negate_real() { return avx2_negate_real_double; }
+		static __m256d negate_imag() { return avx2_negate_imag_double; }
+	};
+#endif
+
+	// power of 2 fft, in place
+	template <class Real>
+	void fft_radix_4(complex<Real>* data, const Basic_fft_tables<Real>& tables, bool inverse) {
+		const int size = tables.size;
+		const complex<Real>* twiddles = tables.twiddles.data();
+		// bit reversal permutation
+		for (int i = 0; i < size; i++) {
+			int j = tables.bit_reversal[i];
+			if (i < j) std::swap(data[i], data[j]);
+		}
+		int m = 1;
+		// one radix-2 stage if the number of stages is odd
+		if (tables.log2_size & 1) {
+			for (int i = 0; i < size; i += 2) {
+				complex<Real> a = data[i];
+				complex<Real> b = data[i + 1];
+				data[i] = a + b;
+				data[i + 1] = a - b;
+			}
+			m = 2;
+		}
+#ifdef DMIMG_AVX2
+		const complex<Real>* stage_twiddles = tables.stage_twiddles.data();
+#endif
+		// radix-4 stages, 4 transforms of size m are combined into one of size 4 * m
+		for (; m < size; m *= 4) {
+#ifdef DMIMG_AVX2
+			if constexpr (std::is_same<Real, float>::value) {
+				if (m >= 4) {
+					dmimg::radix_4_stage_avx2(data, size, m, stage_twiddles, inverse);
+					stage_twiddles += 3 * m;
+					continue;
+				}
+			}
+#endif
+			const int stride = size / (4 * m);
+			for (int block = 0; block < size; block += 4 * m) {
+				complex<Real>* x = data + block;
+				for (int k = 0; k < m; k++) {
+					complex<Real> w1 = twiddles[k * stride];
+					complex<Real> w2 = twiddles[2 * k * stride];
+					complex<Real> w3 = twiddles[3 * k * stride];
+					if (inverse) {
+						w1 = std::conj(w1);
+						w2 = std::conj(w2);
+						w3 = std::conj(w3);
+					}
+					complex<Real> a = x[k];
+					complex<Real> b = dmimg::complex_multiply(x[k + m], w2);
+					complex<Real> c = dmimg::complex_multiply(x[k + 2 * m], w1);
+					complex<Real> d = dmimg::complex_multiply(x[k + 3 * m], w3);
+					complex<Real> t0 = a + b;
+					complex<Real> t1 = a - b;
+					complex<Real> t2 = c + d;
+					// (c - d) multiplied by -i (forward) or i (inverse)
+					complex<Real> t3 = inverse ? complex<Real>(-(c.imag() - d.imag()), c.real() - d.real())
+						: complex<Real>(c.imag() - d.imag(), -(c.real() - d.real()));
+					x[k] = t0 + t2;
+					x[k + m] = t1 + t3;
+					x[k + 2 * m] = t0 - t2;
+					x[k + 3 * m] = t1 - t3;
+				}
+			}
+		}
+	}
+
+	// multiplication by -i
+	template <class Real>
+	inline complex<Real> multiply_minus_i(const complex<Real>& a) {
+		return complex<Real>(a.imag(), -a.real());
+	}
+
+	// one stage of mixed radix fft: radix transforms of size m are combined into one of size radix * m
+	// forward only, Radix = 0 is the general butterfly of any radix, y is a scratch of radix elements
+	template <int Radix, class Real>
+	void mixed_radix_stage(complex<Real>* data, int size, int radix, int m, const complex<Real>* twiddles, complex<Real>* y) {
+		const int stride = size / (radix * m);
+		const int root_stride = size / radix;
+		const Real sin_60 = Real(std::sqrt(3.0) / 2.0);
+		const Real cos_72 = Real(std::cos(2 * value_pi_double / 5)), sin_72 = Real(std::sin(2 * value_pi_double / 5));
+		const Real cos_144 = Real(std::cos(4 * value_pi_double / 5)), sin_144 = Real(std::sin(4 * value_pi_double / 5));
+		for (int block = 0; block < size; block += radix * m) {
+			complex<Real>* x = data + block;
+			for (int k = 0; k < m; k++) {
+				y[0] = x[k];
+				for (int q = 1; q < radix; q++) {
+					y[q] = dmimg::complex_multiply(x[k + q * m], twiddles[q * k * stride]);
+				}
+				if constexpr (Radix == 2) {
+					x[k] = y[0] + y[1];
+					x[k + m] = y[0] - y[1];
+				}
+				else if constexpr (Radix == 3) {
+					complex<Real> t = y[0] - Real(0.5) * (y[1] + y[2]);
+					complex<Real> u = sin_60 * dmimg::multiply_minus_i(y[1] - y[2]);
+					x[k] = y[0] + y[1] + y[2];
+					x[k + m] = t + u;
+					x[k + 2 * m] = t - u;
+				}
+				else if constexpr (Radix == 4) {
+					complex<Real> t0 = y[0] + y[2];
+					complex<Real> t1 = y[0] - y[2];
+					complex<Real> t2 = y[1] + y[3];
+					complex<Real> t3 = dmimg::multiply_minus_i(y[1] - y[3]);
+					x[k] = t0 + t2;
+					x[k + m] = t1 + t3;
+					x[k + 2 * m] = t0 - t2;
+					x[k + 3 * m] = t1 - t3;
+				}
+				else if constexpr (Radix == 5) {
+					complex<Real> a1 = y[1] + y[4], b1 = y[1] - y[4];
+					complex<Real> a2 = y[2] + y[3], b2 = y[2] - y[3];
+					complex<Real> t1 = y[0] + cos_72 * a1 + cos_144 * a2;
+					complex<Real> t2 = y[0] + cos_144 * a1 + cos_72 * a2;
+					complex<Real> u1 = dmimg::multiply_minus_i(sin_72 * b1 + sin_144 * b2);
+					complex<Real> u2 = dmimg::multiply_minus_i(sin_144 * b1 - sin_72 * b2);
+					x[k] = y[0] + a1 + a2;
+					x[k + m] = t1 + u1;
+					x[k + 4 * m] = t1 - u1;
+					x[k + 2 * m] = t2 + u2;
+					x[k + 3 * m] = t2 - u2;
+				}
+				else {
+					// direct dft of size radix, roots of unity of radix are every root_stride-th twiddle
+					// root = q * p % radix is reduced step by step, q * p could overflow int for a large prime
+					for (int p = 0; p < radix; p++) {
+						complex<Real> sum = y[0];
+						int root = 0;
+						for (int q = 1; q < radix; q++) {
+							root += p;
+							if (root >= radix) root -= radix;
+							sum += dmimg::complex_multiply(y[q], twiddles[root * root_stride]);
+						}
+						x[k + p * m] = sum;
+					}
+				}
+			}
+		}
+	}
+
+	// mixed radix fft, the inverse transform is conj(fft(conj(data)))
+	template <class Real>
+	void fft_mixed_radix(complex<Real>* data, const Basic_fft_tables<Real>& tables, bool inverse) {
+		const int size = tables.size;
+		// scratch memory is kept per thread, so nothing is allocated after the first transform
+		// (the largest radix is the last one or 4)
+		thread_local vector<complex<Real>> buffer;
+		const size_t buffer_size = size + std::max(tables.factors[0], tables.factors.back());
+		if (buffer.size() < buffer_size) buffer.resize(buffer_size);
+		complex<Real>* work = buffer.data();
+		complex<Real>* y = buffer.data() + size;
+		// digit reversal permutation
+		for (int i = 0; i < size; i++) {
+			work[tables.digit_reversal[i]] = inverse ? std::conj(data[i]) : data[i];
+		}
+		int m = 1;
+		for (int stage = tables.factors.size() - 1; stage >= 0; stage--) {
+			int radix = tables.factors[stage];
+			const complex<Real>* twiddles = tables.twiddles.data();
+			switch (radix) {
+			case 2: dmimg::mixed_radix_stage<2>(work, size, radix, m, twiddles, y); break;
+			case 3: dmimg::mixed_radix_stage<3>(work, size, radix, m, twiddles, y); break;
+			case 4: dmimg::mixed_radix_stage<4>(work, size, radix, m, twiddles, y); break;
+			case 5: dmimg::mixed_radix_stage<5>(work, size, radix, m, twiddles, y); break;
+			default: dmimg::mixed_radix_stage<0>(work, size, radix, m, twiddles, y);
+			}
+			m *= radix;
+		}
+		for (int i = 0; i < size; i++) {
+			data[i] = inverse ? std::conj(work[i]) : work[i];
+		}
+	}
+
+	// Bluestein's fft: X[k] = chirp[k] * sum(data[n] * chirp[n] * conj(chirp[k - n]))
+	// the sum is a convolution done with power of 2 transforms
+	template <class Real>
+	void fft_bluestein(complex<Real>* data, const Basic_fft_tables<Real>& tables, bool inverse) {
+		const int size = tables.size;
+		const Basic_fft_tables<Real>& convolution_tables = *tables.convolution_tables;
+		const int convolution_size = convolution_tables.size;
+		thread_local vector<complex<Real>> buffer;
+		if (buffer.size() < size_t(convolution_size)) buffer.resize(convolution_size);
+		complex<Real>* work = buffer.data();
+		for (int n = 0; n < size; n++) {
+			complex<Real> value = inverse ? std::conj(data[n]) : data[n];
+			work[n] = dmimg::complex_multiply(value, tables.chirp[n]);
+		}
+		for (int n = size; n < convolution_size; n++) work[n] = 0.0;
+		dmimg::fft_radix_4(work, convolution_tables, false);
+		for (int n = 0; n < convolution_size; n++) {
+			work[n] = dmimg::complex_multiply(work[n], tables.chirp_spectrum[n]);
+		}
+		dmimg::fft_radix_4(work, convolution_tables, true);
+		for (int k = 0; k < size; k++) {
+			complex<Real> value = dmimg::complex_multiply(work[k], tables.chirp[k]);
+			data[k] = inverse ? std::conj(value) : value;
+		}
+	}
+
+	// in-place fft of data[0], data[1], ... data[size - 1]
+	// inverse = true gives the inverse transform without scaling by 1 / size
+	// nothing is allocated here (apart from per thread scratch for sizes that are not a power of 2)
+	template <class Real>
+	void fft_1D(complex<Real>* data, const Basic_fft_tables<Real>& tables, bool inverse) {
+		if (tables.size <= 1) return;
+		switch (tables.algorithm) {
+		case Fft_algorithm::radix_4:
+			dmimg::fft_radix_4(data, tables, inverse);
+			break;
+		case Fft_algorithm::mixed_radix:
+			dmimg::fft_mixed_radix(data, tables, inverse);
+			break;
+		case Fft_algorithm::bluestein:
+			dmimg::fft_bluestein(data, tables, inverse);
+			break;
+		}
+	}
+
+	const char* fft_algorithm_name(Fft_algorithm algorithm) {
+		switch (algorithm) {
+		case Fft_algorithm::radix_4: return "radix_4";
+		case Fft_algorithm::mixed_radix: return "mixed_radix";
+		case Fft_algorithm::bluestein: return "bluestein";
+		}
+		return "";
+	}
+
+	// times mixed radix and Bluestein fft of the size and remembers the faster one in the wisdom
+	Fft_algorithm measure_fft_algorithm(int size) {
+		if (is_power_of_two(size)) return Fft_algorithm::radix_4;
+		{
+			std::lock_guard<std::mutex> lock(fft_wisdom_mutex);
+			auto it = fft_wisdom.find(size);
+			if (it != fft_wisdom.end()) return it->second;
+		}
+		vector<complex<double>> data(size);
+		Fft_algorithm best = Fft_algorithm::mixed_radix;
+		double best_time = std::numeric_limits<double>::max();
+		for (Fft_algorithm algorithm : { Fft_algorithm::mixed_radix, Fft_algorithm::bluestein }) {
+			const Fft_tables& tables = dmimg::get_fft_tables(size, algorithm);
+			// the best of a few runs, at least 10 milliseconds together
+			double time = std::numeric_limits<double>::max();
+			auto measuring_start = std::chrono::high_resolution_clock::now();
+			for (int run = 0; run < 3 or std::chrono::high_resolution_clock::now() - measuring_start < std::chrono::milliseconds(10); run++) {
+				for (int i = 0; i < size; i++) data[i] = complex<double>(i % 7, i % 3);
+				auto start = std::chrono::high_resolution_clock::now();
+				dmimg::fft_1D(data.data(), tables);
+				auto stop = std::chrono::high_resolution_clock::now();
+				time = std::min(time, std::chrono::duration<double>(stop - start).count());
+			}
+			if (time < best_time) {
+				best_time = time;
+				best = algorithm;
+			}
+		}
+		std::lock_guard<std::mutex> lock(fft_wisdom_mutex);
+		fft_wisdom[size] = best;
+		return best;
+	}
+
+	// wisdom file, text: one "size algorithm" pair per line
+	// a missing file is not an error (nothing has been measured yet)
+	void load_fft_wisdom(const std::string& path) {
+		std::ifstream file(path);
+		if (!file) return;
+		std::lock_guard<std::mutex> lock(fft_wisdom_mutex);
+		int size;
+		std::string name;
+		while (file >> size >> name) {
+			for (Fft_algorithm algorithm : { Fft_algorithm::mixed_radix, Fft_algorithm::bluestein }) {
+				if (name == dmimg::fft_algorithm_name(algorithm) and size > 0 and !is_power_of_two(size)) {
+					fft_wisdom[size] = algorithm;
+				}
+			}
+		}
+	}
+
+	void save_fft_wisdom(const std::string& path) {
+		std::ofstream file(path);
+		if (!file) dmimg::error("Can't write fft wisdom file " + path);
+		std::lock_guard<std::mutex> lock(fft_wisdom_mutex);
+		for (const auto& entry : fft_wisdom) {
+			file << entry.first << " " << dmimg::fft_algorithm_name(entry.second) << "\n";
+		}
+	}
+
+	// name of the algorithm chosen for a size, with the radices
+	std::string fft_plan_description(int size) {
+		const Fft_tables& tables = dmimg::get_fft_tables(size);
+		switch (tables.algorithm) {
+		case Fft_algorithm::radix_4:
+			return "radix-4";
+		case Fft_algorithm::mixed_radix: {
+			std::string description = "mixed radix ";
+			for (size_t i = 0; i < tables.factors.size(); i++) {
+				if (i > 0) description += "*";
+				description += std::to_string(tables.factors[i]);
+			}
+			return description;
+		}
+		case Fft_algorithm::bluestein:
+			return "Bluestein, convolution of size " + std::to_string(tables.convolution_tables->size);
+		}
+		return "";
+	}
+
+	void fast_fourier_1D(vector<complex<double>>& input) {
+		if (input.size() <= 1) return;
+		dmimg::fft_1D(input.data(), dmimg::get_fft_tables(input.size()));
+	}
+
+	// 2D fft: rows first and then columns, inverse = true skips the scaling
+	void fft_2D(vector<vector<complex<double>>>& input, bool inverse) {
+		const int height = input.size();
+		const int width = input[0].size();
+		const Fft_tables& row_tables = dmimg::get_fft_tables(width);
+		const Fft_tables& column_tables = dmimg::get_fft_tables(height);
+		// perform rows
+		for (int row = 0; row < height; row++) {
+			dmimg::fft_1D(input[row].data(), row_tables, inverse);
+		}
+		// perform columns, one buffer for all of them
+		vector<complex<double>> column_buffer(height);
+		for (int column = 0; column < width; column++) {
+			for (int y = 0; y < height; y++) column_buffer[y] = input[y][column];
+			dmimg::fft_1D(column_buffer.data(), column_tables, inverse);
+			for (int y = 0; y < height; y++) input[y][column] = column_buffer[y];
+		}
+	}
+
+	// filter of the half spectrum (see filters), applied without storing a mask
+	// apply multiplies count elements of row y, starting at column x, by the filter values
+	class Frequency_filter {
+	public:
+		virtual ~Frequency_filter() = default;
+		virtual void apply(complex<double>* values, int x, int y, int count) const = 0;
+		virtual void apply(complex<float>* values, int x, int y, int count) const = 0;
+	};
+
+	// both precisions of apply are the template apply_values of the Filter
+	template <class Filter>
+	class Basic_frequency_filter : public Frequency_filter {
+	public:
+		void apply(complex<double>* values, int x, int y, int count) const override {
+			static_cast<const Filter*>(this)->apply_values(values, x, y, count);
+		}
+		void apply(complex<float>* values, int x, int y, int count) const override {
+			static_cast<const Filter*>(this)->apply_values(values, x, y, count);
+		}
+	};
+
+	// number of adjacent columns transformed together, 8 complex numbers are two cache lines
+	const int fft_column_block = 8;
+	// the pieces of consecutive rows are a whole row apart (usually on another page), the hardware
+	// prefetcher doesn't follow them, so the piece this many rows ahead is requested in advance
+	const int fft_column_prefetch = 8;
+
+	template <class Real>
+	inline void prefetch_row_piece([[maybe_unused]] const complex<Real>* piece, [[maybe_unused]] int count) {
+#ifdef DMIMG_AVX2
+		const char* bytes = reinterpret_cast<const char*>(piece);
+		for (size_t offset = 0; offset < count * sizeof(complex<Real>); offset += 64) _mm_prefetch(bytes + offset, _MM_HINT_T0);
+#endif
+	}
+
+	// radix-4 fft of count interleaved columns, element i of column c is data[i * count + c]
+	// the same as fft_radix_4, but every butterfly is done for count adjacent numbers at once,
+	// so the innermost loops run over contiguous memory
+	// permuted = true means the rows are already in bit reversal order (permuted while copying them in)
+	template <class Real>
+	void fft_radix_4_columns(complex<Real>* data, int count, const Basic_fft_tables<Real>& tables, bool inverse, bool permuted = false) {
+		const int size = tables.size;
+		const complex<Real>* twiddles = tables.twiddles.data();
+		const Real sign = inverse ? -1.0 : 1.0;
+		// bit reversal permutation of whole rows
+		for (int i = 0; i < size and not permuted; i++) {
+			int j = tables.bit_reversal[i];
+			if (i < j) std::swap_ranges(data + size_t(i) * count, data + size_t(i + 1) * count, data + size_t(j) * count);
+		}
+		int m = 1;
+		if (tables.log2_size & 1) {
+			for (int i = 0; i < size; i += 2) {
+				complex<Real>* x0 = data + size_t(i) * count;
+				complex<Real>* x1 = x0 + count;
+				for (int c = 0; c < count; c++) {
+					complex<Real> a = x0[c];
+					complex<Real> b = x1[c];
+					x0[c] = a + b;
+					x1[c] = a - b;
+				}
+			}
+			m = 2;
+		}
+		for (; m < size; m *= 4) {
+			const int stride = size / (4 * m);
+			for (int block = 0; block < size; block += 4 * m) {
+				for (int k = 0; k < m; k++) {
+#ifdef DMIMG_AVX2
+					using Avx2 = Avx2_complex<Real>;
+					if (count % Avx2::count == 0) {
+						const auto twiddle_sign = inverse ? Avx2::negate_imag() : Avx2::no_sign();
+						const auto rotation_sign = inverse ? Avx2::negate_real() : Avx2::negate_imag();
+						auto w1 = dmimg::broadcast_twiddle_avx2(twiddles[k * stride], twiddle_sign);
+						auto w2 = dmimg::broadcast_twiddle_avx2(twiddles[2 * k * stride], twiddle_sign);
+						auto w3 = dmimg::broadcast_twiddle_avx2(twiddles[3 * k * stride], twiddle_sign);
+						Real* x0 = reinterpret_cast<Real*>(data + size_t(block + k) * count);
+						const size_t step = size_t(2) * m * count;
+						for (int c = 0; c < count; c += Avx2::count) {
+							dmimg::radix_4_butterfly_avx2(x0 + 2 * c, x0 + step + 2 * c, x0 + 2 * step + 2 * c, x0 + 3 * step + 2 * c, w1, w2, w3, rotation_sign);
+						}
+						continue;
+					}
+#endif
+					complex<Real> w1 = twiddles[k * stride];
+					complex<Real> w2 = twiddles[2 * k * stride];
+					complex<Real> w3 = twiddles[3 * k * stride];
+					if (inverse) {
+						w1 = std::conj(w1);
+						w2 = std::conj(w2);
+						w3 = std::conj(w3);
+					}
+					complex<Real>* x0 = data + size_t(block + k) * count;
+					complex<Real>* x1 = x0 + size_t(m) * count;
+					complex<Real>* x2 = x1 + size_t(m) * count;
+					complex<Real>* x3 = x2 + size_t(m) * count;
+					for (int c = 0; c < count; c++) {
+						complex<Real> a = x0[c];
+						complex<Real> b = dmimg::complex_multiply(x1[c], w2);
+						complex<Real> cc = dmimg::complex_multiply(x2[c], w1);
+						complex<Real> d = dmimg::complex_multiply(x3[c], w3);
+						complex<Real> t0 = a + b;
+						complex<Real> t1 = a - b;
+						complex<Real> t2 = cc + d;
+						// (cc - d) multiplied by -i (forward) or i (inverse)
+						complex<Real> t3(sign * (cc.imag() - d.imag()), -sign * (cc.real() - d.real()));
+						x0[c] = t0 + t2;
+						x1[c] = t1 + t3;
+						x2[c] = t0 - t2;
+						x3[c] = t1 - t3;
+					}
+				}
+			}
+		}
+	}
+
+	// fft of the columns of a matrix
+	// columns are copied out in blocks of fft_column_block adjacent ones: every row gives one
+	// contiguous piece of the block, so the matrix is read and written row by row instead of
+	// jumping a whole row for every element of a single column
+	// power of 2 heights transform the whole block at once (fft_radix_4_columns),
+	// other sizes transpose the block and transform the columns one by one
+	// the filter (if given) is applied to every piece of a row before it is copied to the block
+	// with a source (the same size as input) the rows are read from it, input is only written,
+	// so a spectrum which must not change (a mapped spectrum cache) is transformed without copying it first
+	template <class Real>
+	void fft_columns(Basic_complex_matrix<Real>& input, const Basic_fft_tables<Real>& column_tables, bool inverse, const Frequency_filter* filter = nullptr, const complex<Real>* source = nullptr) {
+		const int width = input.width();
+		const int height = input.height();
+		const bool interleaved = column_tables.algorithm == Fft_algorithm::radix_4;
+		const int blocks_count = (width + fft_column_block - 1) / fft_column_block;
+		// blocks are independent, every thread has its own buffer
+		dmimg::parallel_for(0, blocks_count, [&](int block_begin, int block_end) {
+			vector<complex<Real>> block_buffer(size_t(fft_column_block) * height);
+			for (int block = block_begin; block < block_end; block++) {
+				const int x0 = block * fft_column_block;
+				const int block_width = std::min(fft_column_block, width - x0);
+				// element y of column i goes to y * block_width + i (interleaved) or i * height + y
+				// interleaved rows are stored in bit reversal order, which is the first step of the fft
+				const size_t row_step = interleaved ? block_width : 1;
+				const size_t column_step = interleaved ? 1 : height;
+				for (int y = 0; y < height; y++) {
+					if (y + fft_column_prefetch < height) {
+						const int ahead = y + fft_column_prefetch;
+						dmimg::prefetch_row_piece((source ? source + size_t(ahead) * width : input.row(ahead)) + x0, block_width);
+					}
+					complex<Real>* row = input.row(y) + x0;
+					if (source) std::copy(source + size_t(y) * width + x0, source + size_t(y) * width + x0 + block_width, row);
+					if (filter) filter->apply(row, x0, y, block_width);
+					complex<Real>* target = block_buffer.data() + (interleaved ? column_tables.bit_reversal[y] : y) * row_step;
+					for (int i = 0; i < block_width; i++) {
+						target[i * column_step] = row[i];
+					}
+				}
+				if (interleaved) {
+					dmimg::fft_radix_4_columns(block_buffer.data(), block_width, column_tables, inverse, true);
+				}
+				else {
+					for (int i = 0; i < block_width; i++) {
+						dmimg::fft_1D(block_buffer.data() + size_t(i) * height, column_tables, inverse);
+					}
+				}
+				// and back
+				for (int y = 0; y < height; y++) {
+					if (y + fft_column_prefetch < height) dmimg::prefetch_row_piece(input.row(y + fft_column_prefetch) + x0, block_width);
+					complex<Real>* row = input.row(y) + x0;
+					for (int i = 0; i < block_width; i++) {
+						row[i] = block_buffer[y * row_step + i * column_step];
+					}
+				}
+			}
+		});
+	}
+
+	template <class Real>
+	void fft_columns(Basic_complex_matrix<Real>& input, bool inverse) {
+		dmimg::fft_columns(input, dmimg::get_fft_tables<Real>(input.height()), inverse);
+	}
+
+	template <class Real>
+	void fft_2D(Basic_complex_matrix<Real>& input, bool inverse) {
+		const Basic_fft_tables<Real>& row_tables = dmimg::get_fft_tables<Real>(input.width());
+		// perform rows
+		dmimg::parallel_for(0, input.height(), [&](int row_begin, int row_end) {
+			for (int row = row_begin; row < row_end; row++) {
+				dmimg::fft_1D(input.row(row), row_tables, inverse);
+			}
+		});
+		// perform columns
+		dmimg::fft_columns(input, inverse);
+	}
+
+	void fast_fourier_2D(vector<vector<complex<double>>>& input) {
+		dmimg::fft_2D(input, false);
+	}
+
+	template <class Real>
+	void fast_fourier_2D(Basic_complex_matrix<Real>& input) {
+		dmimg::fft_2D(input, false);
+	}
+
+	// takes input image and computes fast Fourier transform with decimation in spatial domain
+	// returns matrix of complex numbers
+	template <class Real = double, class T>
+	Basic_complex_matrix<Real> fft_spatial_domain(CImg<T>& input_img, int channel = 0) {
+		Basic_complex_matrix<Real> output = dmimg::image_to_complex_matrix<Real>(input_img, channel);
+		dmimg::fft_2D(output, false);
+		return output;
+	}
+
+	void fft_inverse_2D(vector<vector<complex<double>>>& input) {
+		// inverse transform directly, no conjugation needed
+		dmimg::fft_2D(input, true);
+		// scale the numbers properly
+		double sizes_multiplied = input.size() * input[0].size();
+		for (int y = 0; y < input.size(); y++) {
+			for (int x = 0; x < input[0].size(); x++) {
+				input[y][x] = input[y][x] / sizes_multiplied;
+			}
+		}
+	}
+
+	template <class Real>
+	void fft_inverse_2D(Basic_complex_matrix<Real>& input) {
+		dmimg::fft_2D(input, true);
+		// scale the numbers properly
+		const Real sizes_multiplied = Real(double(input.width()) * input.height());
+		complex<Real>* data = input.data();
+		for (size_t i = 0; i < input.size(); i++) {
+			data[i] /= sizes_multiplied;
+		}
+	}
+
+	// takes a table of complex numbers, performs inverse fft and returns an image
+	// the inverse transform is done in place, so the input is overwritten
+	// the values are rounded: 127.9999 (rounding errors of exactly 128) is 128, not 127
+	template <class Real>
+	CImg<unsigned char> fft_inverse_2D_img(Basic_complex_matrix<Real>& input) {
+		fft_inverse_2D(input);
+		CImg<unsigned char> output(input.width(), input.height(), 1, 3);
+		for (int y = 0; y < input.height(); y++) {
+			for (int x = 0; x < input.width(); x++) {
+				dmimg::set_rgb_safe(output, x, y, int(std::abs(input(x, y)) + 0.5));
+			}
+		}
+		return output;
+	}
+
+	// real input fft
+	// the spectrum of a real image is Hermitian: X(-u, -v) = conj(X(u, v)), so only
+	// width / 2 + 1 columns are stored (the half spectrum), the rest follows from the symmetry
+	// every row of width real numbers is transformed as width / 2 complex numbers
+	// (even samples as real parts, odd samples as imaginary parts) and then separated
+
+	// width of the image of a half spectrum
+	template <class Real>
+	inline int full_width(const Basic_complex_matrix<Real>& half_spectrum) {
+		return 2 * (half_spectrum.width() - 1);
+	}
+
+	// row holds width / 2 + 1 complex numbers, on input the first width / 2 of them are
+	// the real samples (interleaved), on output the whole row is the half spectrum of the samples
+	template <class Real>
+	void fft_real_row(complex<Real>* row, const Basic_fft_tables<Real>& half_tables, const Basic_fft_tables<Real>& full_tables) {
+		const int half = half_tables.size;
+		dmimg::fft_1D(row, half_tables);
+		const complex<Real>* twiddles = full_tables.twiddles.data();
+		// X[k] = (Z[k] + conj(Z[half - k])) / 2 - i * w^k * (Z[k] - conj(Z[half - k])) / 2
+		auto separate = [&](int k, complex<Real> z, complex<Real> z_mirror) {
+			complex<Real> even = (z + std::conj(z_mirror)) * Real(0.5);
+			complex<Real> odd = (z - std::conj(z_mirror)) * Real(0.5);
+			odd = complex<Real>(odd.imag(), -odd.real());
+			return even + dmimg::complex_multiply(twiddles[k], odd);
+		};
+		for (int k = 1; k <= half / 2; k++) {
+			complex<Real> z = row[k];
+			complex<Real> z_mirror = row[half - k];
+			row[k] = separate(k, z, z_mirror);
+			if (k != half - k) row[half - k] = separate(half - k, z_mirror, z);
+		}
+		complex<Real> z0 = row[0];
+		row[0] = z0.real() + z0.imag();
+		row[half] = z0.real() - z0.imag();
+	}
+
+	// inverse of fft_real_row without scaling, the output is width * samples
+	template <class Real>
+	void fft_inverse_real_row(complex<Real>* row, const Basic_fft_tables<Real>& half_tables, const Basic_fft_tables<Real>& full_tables) {
+		const int half = half_tables.size;
+		const complex<Real>* twiddles = full_tables.twiddles.data();
+		// X[0] and X[half] of a real row are real, imaginary parts left there by a filter that is not
+		// symmetric are dropped (otherwise they would show up as a constant and an alternating row)
+		row[0] = row[0].real();
+		row[half] = row[half].real();
+		// Z[k] = (X[k] + conj(X[half - k])) + i * conj(w^k) * (X[k] - conj(X[half - k]))
+		auto combine = [&](int k, complex<Real> x, complex<Real> x_mirror) {
+			complex<Real> even = x + std::conj(x_mirror);
+			complex<Real> odd = dmimg::complex_multiply(x - std::conj(x_mirror), std::conj(twiddles[k]));
+			return even + complex<Real>(-odd.imag(), odd.real());
+		};
+		for (int k = 0; k <= half / 2; k++) {
+			complex<Real> x = row[k];
+			complex<Real> x_mirror = row[half - k];
+			row[k] = combine(k, x, x_mirror);
+			if (k != half - k) row[half - k] = combine(half - k, x_mirror, x);
+		}
+		dmimg::fft_1D(row, half_tables, true);
+	}
+
+	enum class Fft_direction { forward, inverse };
+	// precision of the numbers in the transform: complex<double> or complex<float>
+	enum class Fft_precision { double_precision, single_precision };
+	// estimate: the algorithms are chosen by counting operations,
+	// measure: by timing them (slower planning, the choice is kept in the fft wisdom)
+	enum class Fft_planning { estimate, measure };
+
+	// planning used by the plans made by get_fft_plan
+	Fft_planning fft_planning_mode = Fft_planning::estimate;
+	// precision of the filters of the command line (fft_filter_image, fft_spectrum_image)
+	Fft_precision fft_precision_mode = Fft_precision::double_precision;
+	// the filters of the command line transform all 3 channels (fft_spatial_domain_color) instead of the red one
+	bool fft_color_mode = false;
+
+	// plan of the 2D fft of a real image of width x height (half spectrum) in one direction,
+	// with complex<Real> numbers (Real is double or float)
+	// it is made once for many transforms of the same size and keeps the tables of all the 1D
+	// transforms it needs, after construction it is not modified, so it can be executed
+	// from many threads at once
+	template <class Real>
+	class Basic_fft_plan {
+	public:
+		Basic_fft_plan(int width, int height, Fft_direction direction, Fft_planning planning = Fft_planning::estimate)
+			: width_(width), height_(height), direction_(direction) {
+			if (width < 2 or width % 2 != 0) dmimg::error("Can't perfrom real input fft if width is odd.");
+			if (height < 1) dmimg::error("Can't perfrom fft of an empty image.");
+			if (planning == Fft_planning::measure) {
+				dmimg::measure_fft_algorithm(width / 2);
+				dmimg::measure_fft_algorithm(height);
+			}
+			half_row_tables_ = &dmimg::get_fft_tables<Real>(width / 2);
+			// only the twiddles of the full width are used
+			full_row_tables_ = &dmimg::get_fft_tables<Real>(width);
+			column_tables_ = &dmimg::get_fft_tables<Real>(height);
+		}
+
+		int width() const { return width_; }
+		int height() const { return height_; }
+		Fft_direction direction() const { return direction_; }
+		Fft_precision precision() const {
+			return std::is_same<Real, float>::value ? Fft_precision::single_precision : Fft_precision::double_precision;
+		}
+
+		// forward: half spectrum of one channel of the image (red by default), width / 2 + 1 columns
+		template <class T>
+		Basic_complex_matrix<Real> execute(CImg<T>& input_img, int channel = 0) const {
+			Basic_complex_matrix<Real> output(width_ / 2 + 1, height_);
+			execute(input_img, output, channel);
+			return output;
+		}
+
+		// the same into a matrix of the size of the half spectrum, which is all overwritten,
+		// so a sequence of images reuses one matrix
+		template <class T>
+		void execute(CImg<T>& input_img, Basic_complex_matrix<Real>& output, int channel = 0) const {
+			if (direction_ != Fft_direction::forward) dmimg::error("inverse fft plan can't transform an image.");
+			if (input_img.width() != width_ or input_img.height() != height_) dmimg::error("image size is different from the fft plan size.");
+			if (output.width() != width_ / 2 + 1 or output.height() != height_) dmimg::error("spectrum size is different from the fft plan size.");
+			// perform rows
+			dmimg::parallel_for(0, height_, [&](int y_begin, int y_end) {
+				for (int y = y_begin; y < y_end; y++) {
+					complex<Real>* row = output.row(y);
+					Real* samples = reinterpret_cast<Real*>(row);
+					for (int x = 0; x < width_; x++) {
+						samples[x] = input_img(x, y, 0, channel);
+					}
+					dmimg::fft_real_row(row, *half_row_tables_, *full_row_tables_);
+				}
+			});
+			// perform columns
+			dmimg::fft_columns(output, *column_tables_, false);
+		}
+
+		// inverse: the half spectrum is transformed in place and replaced
+		// by real samples, sample x of row y is ((Real*)row(y))[x]
+		// the filter (if given) is applied while the first pass reads the spectrum
+		// with a source, the half spectrum is read from it (it is not changed) and half_spectrum is only the output
+		void execute(Basic_complex_matrix<Real>& half_spectrum, const Frequency_filter* filter = nullptr, const complex<Real>* source = nullptr) const {
+			if (direction_ != Fft_direction::inverse) dmimg::error("forward fft plan can't transform a spectrum.");
+			if (half_spectrum.width() != width_ / 2 + 1 or half_spectrum.height() != height_) dmimg::error("spectrum size is different from the fft plan size.");
+			dmimg::fft_columns(half_spectrum, *column_tables_, true, filter, source);
+			const Real sizes_multiplied = Real(double(width_) * height_);
+			dmimg::parallel_for(0, height_, [&](int y_begin, int y_end) {
+				for (int y = y_begin; y < y_end; y++) {
+					complex<Real>* row = half_spectrum.row(y);
+					dmimg::fft_inverse_real_row(row, *half_row_tables_, *full_row_tables_);
+					Real* samples = reinterpret_cast<Real*>(row);
+					for (int x = 0; x < width_; x++) {
+						samples[x] /= sizes_multiplied;
+					}
+				}
+			});
+		}
+
+		std::string description() const {
+			return std::to_string(width_) + "x" + std::to_string(height_) + (direction_ == Fft_direction::forward ? " forward" : " inverse")
+				+ ", rows: " + dmimg::fft_plan_description(half_row_tables_->size) + ", columns: " + dmimg::fft_plan_description(column_tables_->size);
+		}
+
+	private:
+		int width_;
+		int height_;
+		Fft_direction direction_;
+		const Basic_fft_tables<Real>* half_row_tables_;
+		const Basic_fft_tables<Real>* full_row_tables_;
+		const Basic_fft_tables<Real>* column_tables_;
+	};
+
+	using Fft_plan = Basic_fft_plan<double>;
+	using Fft_plan_float = Basic_fft_plan<float>;
+
+	// plans are made once per (width, height, direction) and precision with fft_planning_mode
+	template <class Real = double>
+	const Basic_fft_plan<Real>& get_fft_plan(int width, int height, Fft_direction direction) {
+		static std::map<std::tuple<int, int, Fft_direction>, std::unique_ptr<Basic_fft_plan<Real>>> cache;
+		static std::mutex cache_mutex;
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		auto& plan = cache[std::make_tuple(width, height, direction)];
+		if (!plan) plan = std::make_unique<Basic_fft_plan<Real>>(width, height, direction, fft_planning_mode);
+		return *plan;
+	}
+
+	// takes input image (red channel or the given one) and returns its half spectrum, width / 2 + 1 columns
+	// fft_spatial_domain_half<float>(img) gives the spectrum in float
+	template <class Real = double, class T>
+	Basic_complex_matrix<Real> fft_spatial_domain_half(CImg<T>& input_img, int channel = 0) {
+		return dmimg::get_fft_plan<Real>(input_img.width(), input_img.height(), Fft_direction::forward).execute(input_img, channel);
+	}
+
+	// inverse of fft_spatial_domain_half, the half spectrum is transformed in place
+	// and returned as real samples: sample x of row y is ((Real*)row(y))[x]
+	// the filter (if given) is applied to the spectrum first
+	template <class Real>
+	void fft_inverse_2D_half(Basic_complex_matrix<Real>& half_spectrum, const Frequency_filter* filter = nullptr) {
+		dmimg::get_fft_plan<Real>(dmimg::full_width(half_spectrum), half_spectrum.height(), Fft_direction::inverse).execute(half_spectrum, filter);
+	}
+
+	// takes a half spectrum, performs inverse fft and returns an image (rounded, as fft_inverse_2D_img)
+	// the inverse transform is done in place, so the input is overwritten
+	template <class Real>
+	CImg<unsigned char> fft_inverse_2D_img_half(Basic_complex_matrix<Real>& half_spectrum, const Frequency_filter* filter = nullptr) {
+		fft_inverse_2D_half(half_spectrum, filter);
+		const int width = dmimg::full_width(half_spectrum);
+		CImg<unsigned char> output(width, half_spectrum.height(), 1, 3);
+		dmimg::parallel_for(0, half_spectrum.height(), [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				const Real* samples = reinterpret_cast<const Real*>(half_spectrum.row(y));
+				for (int x = 0; x < width; x++) {
+					dmimg::set_rgb_safe(output, x, y, int(std::abs(samples[x]) + 0.5));
+				}
+			}
+		});
+		return output;
+	}
+
+	// the whole spectrum (for visualisation) restored from the half spectrum
+	template <class Real>
+	Basic_complex_matrix<Real> full_spectrum(const Basic_complex_matrix<Real>& half_spectrum) {
+		const int width = dmimg::full_width(half_spectrum);
+		const int height = half_spectrum.height();
+		Basic_complex_matrix<Real> output(width, height);
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				for (int x = 0; x < width; x++) {
+					if (x < half_spectrum.width()) {
+						output(x, y) = half_spectrum(x, y);
+					}
+					else {
+						output(x, y) = std::conj(half_spectrum(width - x, (height - y) % height));
+					}
+				}
+			}
+		});
+		return output;
+	}
+
+	// coordinates of element (x, y) of the half spectrum in the full spectrum with swapped quarters
+	// (zero frequency at (width / 2, height / 2)), where the masks are defined
+	inline int centered_x(int x, int width) {
+		return (x + width / 2) % width;
+	}
+	inline int centered_y(int y, int height) {
+		return (y + height / 2) % height;
+	}
+
+	// row y of the full spectrum with the zero frequency in the middle (the same as the full spectrum
+	// with swapped quarters), read straight from the half spectrum: the other half is its mirror image,
+	// X(u, v) = conj(X(width - u, height - v))
+	template <class Real>
+	void centered_spectrum_row(const Basic_complex_matrix<Real>& half_spectrum, int y, complex<Real>* row) {
+		const int width = dmimg::full_width(half_spectrum);
+		const int height = half_spectrum.height();
+		// frequency shown in row y (the inverse of centered_y)
+		const int v = (y + height - height / 2) % height;
+		const complex<Real>* direct = half_spectrum.row(v);
+		const complex<Real>* mirror = half_spectrum.row((height - v) % height);
+		for (int x = 0; x < width; x++) {
+			int u = (x + width - width / 2) % width;
+			row[x] = (u < half_spectrum.width()) ? direct[u] : std::conj(mirror[width - u]);
+		}
+	}
+
+	// the largest |X| of the half spectra
+	template <class Real>
+	double max_magnitude(const vector<const Basic_complex_matrix<Real>*>& half_spectra) {
+		double largest = 0;
+		for (const Basic_complex_matrix<Real>* half_spectrum : half_spectra) {
+			vector<double> row_largest(half_spectrum->height(), 0.0);
+			dmimg::parallel_for(0, half_spectrum->height(), [&](int y_begin, int y_end) {
+				for (int y = y_begin; y < y_end; y++) {
+					const Real* parts = reinterpret_cast<const Real*>(half_spectrum->row(y));
+					Real squared = 0;
+					for (int i = 0; i < 2 * half_spectrum->width(); i += 2) {
+						squared = std::max(squared, parts[i] * parts[i] + parts[i + 1] * parts[i + 1]);
+					}
+					row_largest[y] = squared;
+				}
+			});
+			for (double squared : row_largest) largest = std::max(largest, squared);
+		}
+		return std::sqrt(largest);
+	}
+
+	// one plane of the spectrum image of the half spectrum (see spectrum images)
+	template <class Real>
+	void spectrum_plane(const Basic_complex_matrix<Real>& half_spectrum, const Spectrum_levels& levels, unsigned char* plane) {
+		const int width = dmimg::full_width(half_spectrum);
+		dmimg::parallel_for(0, half_spectrum.height(), [&](int y_begin, int y_end) {
+			vector<complex<Real>> row(width);
+			vector<float> buffer(width);
+			for (int y = y_begin; y < y_end; y++) {
+				dmimg::centered_spectrum_row(half_spectrum, y, row.data());
+				dmimg::spectrum_row_levels(row.data(), width, levels, buffer.data(), plane + size_t(y) * width);
+			}
+		});
+	}
+
+	// magnitude (or phase) spectrum of the image with the zero frequency in the middle, the same as
+	// image_from_complex of the full spectrum with swapped quarters, but nothing is copied or swapped
+	template <class Real>
+	CImg<unsigned char> spectrum_image(const Basic_complex_matrix<Real>& half_spectrum, Spectrum_view view = Spectrum_view::magnitude, Spectrum_scale scale = Spectrum_scale::fixed) {
+		const double largest = (scale == Spectrum_scale::automatic) ? dmimg::max_magnitude<Real>({ &half_spectrum }) : 0;
+		CImg<unsigned char> output(dmimg::full_width(half_spectrum), half_spectrum.height(), 1, 3);
+		dmimg::spectrum_plane(half_spectrum, dmimg::spectrum_levels(view, scale, largest), output.data());
+		dmimg::broadcast_plane(output);
+		return output;
+	}
+
+	// filters
+	// all of them take the half spectrum (fft_spatial_domain_half)
+	// the masks are defined on the full spectrum with swapped quarters, they are not stored:
+	// every filter computes its value for each element while multiplying
+
+	// the same distances as the previous masks: high pass and edge detection measure them
+	// from (width / 2, height / 2) in integers, the other radial filters from (width / 2.0, height / 2.0)
+
+	// radial filter, an element is kept if its squared distance d2 from the center is
+	// inside [inner_squared, outer_squared] (keep_inside) or outside of it (!keep_inside)
+	// keep_first_lines keeps the first row and column of the centered spectrum whatever the distance
+	class Radial_filter : public Basic_frequency_filter<Radial_filter> {
+	public:
+		Radial_filter(int width, int height, double center_x, double center_y, double inner_squared, double outer_squared, bool keep_inside, bool keep_first_lines = false)
+			: width_(width), height_(height), center_x_(center_x), center_y_(center_y),
+			inner_squared_(inner_squared), outer_squared_(outer_squared), keep_inside_(keep_inside), keep_first_lines_(keep_first_lines) {}
+
+		template <class Real>
+		void apply_values(complex<Real>* values, int x, int y, int count) const {
+			const int y_centered = dmimg::centered_y(y, height_);
+			if (keep_first_lines_ and y_centered == 0) return;
+			double dy = y_centered - center_y_;
+			double dy_squared = dy * dy;
+			int x_centered = dmimg::centered_x(x, width_);
+			for (int i = 0; i < count; i++, x_centered++) {
+				if (x_centered == width_) x_centered = 0;
+				double dx = x_centered - center_x_;
+				double d2 = dx * dx + dy_squared;
+				bool inside = inner_squared_ <= d2 and d2 <= outer_squared_;
+				if (inside != keep_inside_ and !(keep_first_lines_ and x_centered == 0)) values[i] = 0.0;
+			}
+		}
+
+	private:
+		int width_;
+		int height_;
+		double center_x_;
+		double center_y_;
+		double inner_squared_;
+		double outer_squared_;
+		bool keep_inside_;
+		bool keep_first_lines_;
+	};
+
+	// squared radius of a band edge, a negative radius has no points inside
+	inline double squared_radius(double radius) {
+		return radius < 0 ? -1.0 : radius * radius;
+	}
+
+	// keeps frequencies with int(distance) > band_size
+	Radial_filter make_high_pass_filter(int width, int height, int band_size) {
+		// int(sqrt(d2)) <= band_size  <=>  d2 < (band_size + 1)^2, d2 is an integer
+		double removed_squared = band_size < 0 ? -1.0 : double(band_size + 1) * (band_size + 1) - 1;
+		return Radial_filter(width, height, width / 2, height / 2, -1.0, removed_squared, false);
+	}
+
+	// keeps frequencies with distance <= threshold
+	// and the first row and column of the centered spectrum, the loops of the previous mask started at 1
+	Radial_filter make_lowpass_filter(int width, int height, int threshold) {
+		return Radial_filter(width, height, width / 2.0, height / 2.0, -1.0, dmimg::squared_radius(threshold), true, true);
+	}
+
+	// keeps frequencies with threshold - band_width / 2 <= distance <= threshold + band_width / 2
+	Radial_filter make_bandpass_filter(int width, int height, int threshold, int band_width) {
+		double inner = threshold - band_width / 2.0;
+		double outer = threshold + band_width / 2.0;
+		return Radial_filter(width, height, width / 2.0, height / 2.0, inner > 0 ? inner * inner : -1.0, dmimg::squared_radius(outer), true);
+	}
+
+	// removes frequencies with threshold - band_width / 2 <= distance <= threshold + band_width / 2
+	Radial_filter make_bandcut_filter(int width, int height, int threshold, int band_width) {
+		double inner = threshold - band_width / 2.0;
+		double outer = threshold + band_width / 2.0;
+		return Radial_filter(width, height, width / 2.0, height / 2.0, inner > 0 ? inner * inner : -1.0, dmimg::squared_radius(outer), false);
+	}
+
+	// high pass edge detection: keeps the frequencies in a double wedge (both directions) around
+	// the line at angle degrees from the x axis (or the y axis), detection_width degrees wide,
+	// and further than radius from the center
+	// a point belongs to the wedge if one of the lines y = int(a * dx) with slope a between
+	// tan(angle -+ detection_width / 2) goes through it, tested directly with the slopes
+	class Wedge_filter : public Basic_frequency_filter<Wedge_filter> {
+	public:
+		Wedge_filter(int width, int height, int angle, int detection_width, int radius, bool zeroAtXaxxis)
+			: width_(width), height_(height), radius_squared_(radius < 0 ? 0.0 : double(radius) * radius), zeroAtXaxxis_(zeroAtXaxxis) {
+			if (!(-45 <= angle and angle <= 45)) dmimg::error("invalid angle: required range <-45,45>");
+			if (!(0 < detection_width and detection_width < 90)) dmimg::error("invalid width: required range (-90,90)");
+			double angle_base = (angle)*value_pi_double / 180.0;
+			// slightly wider, so that tan(45 degrees) computed as 0.9999999999999999 still reaches the diagonal
+			a_min_ = std::tan(angle_base - (detection_width / 2) * value_pi_double / 180.0) - 1e-9;
+			a_max_ = std::tan(angle_base + (detection_width / 2) * value_pi_double / 180.0) + 1e-9;
+		}
+
+		template <class Real>
+		void apply_values(complex<Real>* values, int x, int y, int count) const {
+			int dy = dmimg::centered_y(y, height_) - height_ / 2;
+			int x_centered = dmimg::centered_x(x, width_);
+			for (int i = 0; i < count; i++, x_centered++) {
+				if (x_centered == width_) x_centered = 0;
+				int dx = x_centered - width_ / 2;
+				bool keep = double(dx) * dx + double(dy) * dy >= radius_squared_ and
+					(zeroAtXaxxis_ ? in_wedge(dx, dy) : in_wedge(dy, dx));
+				if (!keep) values[i] = 0.0;
+			}
+		}
+
+	private:
+		// some slope a in [a_min, a_max] gives a * along in [across, across + 1)
+		bool in_wedge(int along, int across) const {
+			if (along > 0) return across <= a_max_ * along and across + 1 > a_min_ * along;
+			if (along < 0) return across + 1 > a_max_ * along and across <= a_min_ * along;
+			return across == 0;
+		}
+
+		int width_;
+		int height_;
+		double radius_squared_;
+		bool zeroAtXaxxis_;
+		double a_min_ = 0;
+		double a_max_ = 0;
+	};
+
+	Wedge_filter make_edge_detection_filter(int width, int height, int angle, int detection_width, int radius, int zeroAtXaxxis) {
+		if (!(zeroAtXaxxis == 0 or zeroAtXaxxis == 1)) dmimg::error("invalid parameter: zeroAtXaxxis can be 0 or 1");
+		return Wedge_filter(width, height, angle, detection_width, radius, zeroAtXaxxis == 1);
+	}
+
+	// phase modifying filter: e^(i * (-x * k * 2 * pi / width - y * l * 2 * pi / height + (k + l) * pi))
+	// for the centered coordinates, it is linear in x, so along a row the value is rotated
+	// by a constant step instead of calling exp for every element
+	class Phase_filter : public Basic_frequency_filter<Phase_filter> {
+	public:
+		Phase_filter(int width, int height, int l, int k)
+			: width_(width), height_(height), l_(l), k_(k),
+			step_(std::polar(1.0, -2.0 * value_pi_double * k / width)) {}
+
+		template <class Real>
+		void apply_values(complex<Real>* values, int x, int y, int count) const {
+			int x_centered = dmimg::centered_x(x, width_);
+			int y_centered = dmimg::centered_y(y, height_);
+			double phase = ((-1.0 * x_centered) * double(k_) * 2.0 * value_pi_double) / width_ +
+				((-1.0 * y_centered) * double(l_) * 2.0 * value_pi_double) / height_ +
+				double(k_ + l_) * value_pi_double;
+			// a full turn of x_centered (width - 1 to 0) changes the phase by k * 2 * pi, so the step stays the same
+			complex<double> rotation = std::polar(1.0, phase);
+			for (int i = 0; i < count; i++) {
+				// the rotation is kept in double also for float values, it is multiplied width / 2 times
+				values[i] = complex<Real>(dmimg::complex_multiply(complex<double>(values[i]), rotation));
+				rotation = dmimg::complex_multiply(rotation, step_);
+			}
+		}
+
+	private:
+		int width_;
+		int height_;
+		int l_;
+		int k_;
+		complex<double> step_;
+	};
+
+	Phase_filter make_phase_modifying_filter(int width, int height, int l, int k) {
+		return Phase_filter(width, height, l, k);
+	}
+
+	// multiplies the half spectrum by the filter (without the inverse fft)
+	template <class Real>
+	void apply_filter(Basic_complex_matrix<Real>& half_spectrum, const Frequency_filter& filter) {
+		dmimg::parallel_for(0, half_spectrum.height(), [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				filter.apply(half_spectrum.row(y), 0, y, half_spectrum.width());
+			}
+		});
+	}
+
+	template <class Real>
+	void high_pass_filter(Basic_complex_matrix<Real>& input, int band_size) {
+		dmimg::apply_filter(input, dmimg::make_high_pass_filter(dmimg::full_width(input), input.height(), band_size));
+	}
+
+	template <class Real>
+	void high_pass_filter_edge_detection(Basic_complex_matrix<Real>& input, int angle, int detection_width, int radius, int zeroAtXaxxis) {
+		dmimg::apply_filter(input, dmimg::make_edge_detection_filter(dmimg::full_width(input), input.height(), angle, detection_width, radius, zeroAtXaxxis));
+	}
+
+	template <class Real>
+	void phase_modifying_filter(Basic_complex_matrix<Real>& input, int l, int k) {
+		dmimg::apply_filter(input, dmimg::make_phase_modifying_filter(dmimg::full_width(input), input.height(), l, k));
+	}
+
+	template <class Real>
+	void lowpass_filter(Basic_complex_matrix<Real>& original, int threshold) {
+		dmimg::apply_filter(original, dmimg::make_lowpass_filter(dmimg::full_width(original), original.height(), threshold));
+	}
+
+	template <class Real>
+	void bandpass_filter(Basic_complex_matrix<Real>& original, int threshold, int width) {
+		dmimg::apply_filter(original, dmimg::make_bandpass_filter(dmimg::full_width(original), original.height(), threshold, width));
+	}
+
+	template <class Real>
+	void bandcut_filter(Basic_complex_matrix<Real>& original, int threshold, int width) {
+		dmimg::apply_filter(original, dmimg::make_bandcut_filter(dmimg::full_width(original), original.height(), threshold, width));
+	}
+
+	// color fft
+	// every channel is transformed by the real input fft (fft_spatial_domain_half), which already packs two
+	// real sequences (even and odd samples of a row) into one complex transform and separates them with
+	// the symmetry of the spectrum, so the 3 channels cost 1.5 complex transforms of the image size
+	// (packing two channels, r + i * g, into one complex transform costs the same 1 + 0.5 transforms,
+	// but adds whole image passes to pack the channels and to separate and join their spectra)
+
+	// half spectra of red, green and blue
+	template <class Real>
+	using Basic_color_spectrum = std::array<Basic_complex_matrix<Real>, 3>;
+	using Color_spectrum = Basic_color_spectrum<double>;
+
+	template <class Real = double, class T>
+	Basic_color_spectrum<Real> fft_spatial_domain_color(CImg<T>& input_img) {
+		Basic_color_spectrum<Real> spectrum;
+		for (int c = 0; c < 3; c++) {
+			spectrum[c] = dmimg::fft_spatial_domain_half<Real>(input_img, c);
+		}
+		return spectrum;
+	}
+
+	// inverse of fft_spatial_domain_color, returns the color image (rounded, as fft_inverse_2D_img_half)
+	// the filter (if given) is applied to all the channels, the spectrum is overwritten
+	template <class Real>
+	CImg<unsigned char> fft_inverse_2D_img_color(Basic_color_spectrum<Real>& spectrum, const Frequency_filter* filter = nullptr) {
+		const int width = dmimg::full_width(spectrum[0]);
+		const int height = spectrum[0].height();
+		for (int c = 0; c < 3; c++) {
+			dmimg::fft_inverse_2D_half(spectrum[c], filter);
+		}
+		CImg<unsigned char> output(width, height, 1, 3);
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				const Real* red = reinterpret_cast<const Real*>(spectrum[0].row(y));
+				const Real* green = reinterpret_cast<const Real*>(spectrum[1].row(y));
+				const Real* blue = reinterpret_cast<const Real*>(spectrum[2].row(y));
+				for (int x = 0; x < width; x++) {
+					dmimg::set_r_safe(output, x, y, int(std::abs(red[x]) + 0.5));
+					dmimg::set_g_safe(output, x, y, int(std::abs(green[x]) + 0.5));
+					dmimg::set_b_safe(output, x, y, int(std::abs(blue[x]) + 0.5));
+				}
+			}
+		});
+		return output;
+	}
+
+	// spectra of the channels (spectrum_image of each of them) in one image,
+	// automatic scale uses the largest magnitude of all the channels, so the colours keep their balance
+	template <class Real>
+	CImg<unsigned char> spectrum_image(const Basic_color_spectrum<Real>& spectrum, Spectrum_view view = Spectrum_view::magnitude, Spectrum_scale scale = Spectrum_scale::fixed) {
+		const double largest = (scale == Spectrum_scale::automatic) ? dmimg::max_magnitude<Real>({ &spectrum[0], &spectrum[1], &spectrum[2] }) : 0;
+		const Spectrum_levels levels = dmimg::spectrum_levels(view, scale, largest);
+		CImg<unsigned char> output(dmimg::full_width(spectrum[0]), spectrum[0].height(), 1, 3);
+		for (int c = 0; c < 3; c++) {
+			dmimg::spectrum_plane(spectrum[c], levels, output.data(0, 0, 0, c));
+		}
+		return output;
+	}
+
+	// spectrum export
+	// the centered full spectrum (as in spectrum_image) in numpy .npy files: name_magnitude.npy and
+	// name_phase.npy (float32) and name_complex.npy (complex64), shape (height, width),
+	// or (3, height, width) for the 3 channels, the values are exact (no approximations)
+
+	// header of the .npy format 1.0, the data follows it
+	void write_npy_header(std::ofstream& file, const std::string& type, const vector<int>& shape) {
+		const std::uint16_t one = 1;
+		const bool little_endian = *reinterpret_cast<const unsigned char*>(&one) == 1;
+		std::string shape_text = "(";
+		for (int size : shape) shape_text += std::to_string(size) + ", ";
+		// (n,) for one dimension, (n, m) for more
+		shape_text.erase(shape_text.size() - (shape.size() > 1 ? 2 : 1));
+		shape_text += ")";
+		std::string header = "{'descr': '" + std::string(little_endian ? "<" : ">") + type + "', 'fortran_order': False, 'shape': " + shape_text + ", }";
+		// magic, version, header length, header: a multiple of 64 bytes ending with a new line
+		const size_t total = (10 + header.size() + 1 + 63) / 64 * 64;
+		header.append(total - 10 - header.size() - 1, ' ');
+		header += '\n';
+		const unsigned char prefix[10] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+			static_cast<unsigned char>(header.size() & 0xff), static_cast<unsigned char>(header.size() >> 8) };
+		file.write(reinterpret_cast<const char*>(prefix), sizeof(prefix));
+		file.write(header.data(), header.size());
+	}
+
+	template <class Real>
+	void export_spectrum(const std::string& name, const vector<const Basic_complex_matrix<Real>*>& half_spectra) {
+		const int width = dmimg::full_width(*half_spectra[0]);
+		const int height = half_spectra[0]->height();
+		vector<int> shape = { height, width };
+		if (half_spectra.size() > 1) shape.insert(shape.begin(), int(half_spectra.size()));
+		std::ofstream magnitude_file(name + "_magnitude.npy", std::ios::binary);
+		std::ofstream phase_file(name + "_phase.npy", std::ios::binary);
+		std::ofstream complex_file(name + "_complex.npy", std::ios::binary);
+		if (!magnitude_file or !phase_file or !complex_file) dmimg::error("Can't write " + name + "_*.npy");
+		dmimg::write_npy_header(magnitude_file, "f4", shape);
+		dmimg::write_npy_header(phase_file, "f4", shape);
+		dmimg::write_npy_header(complex_file, "c8", shape);
+		vector<complex<Real>> row(width);
+		vector<float> magnitudes(width);
+		vector<float> phases(width);
+		vector<complex<float>> values(width);
+		for (const Basic_complex_matrix<Real>* half_spectrum : half_spectra) {
+			for (int y = 0; y < height; y++) {
+				dmimg::centered_spectrum_row(*half_spectrum, y, row.data());
+				for (int x = 0; x < width; x++) {
+					magnitudes[x] = float(std::abs(row[x]));
+					phases[x] = float(std::arg(row[x]));
+					values[x] = complex<float>(row[x]);
+				}
+				magnitude_file.write(reinterpret_cast<const char*>(magnitudes.data()), width * sizeof(float));
+				phase_file.write(reinterpret_cast<const char*>(phases.data()), width * sizeof(float));
+				complex_file.write(reinterpret_cast<const char*>(values.data()), width * sizeof(complex<float>));
+			}
+		}
+		if (!magnitude_file or !phase_file or !complex_file) dmimg::error("Can't write " + name + "_*.npy");
+	}
+
+	// spectrum cache
+	// half spectra are kept in files named after the hash of the image content, so filtering the same
+	// image again (parameter sweeps, the filter bank) skips the forward fft: the file is mapped to memory
+	// and the first pass of the inverse fft reads the spectrum straight from the mapping
+	// file: Spectrum_cache_header, then the half spectra of the channels one after another
+
+	// directory of the cache files (--spectrum_cache), empty: the spectrum is computed every time
+	std::string spectrum_cache_directory = "";
+
+	struct Spectrum_cache_header {
+		char magic[8];
+		std::uint64_t hash;
+		std::int32_t width;     // of the image, the spectra have width / 2 + 1 columns
+		std::int32_t height;
+		std::int32_t channels;
+		std::int32_t real_size; // sizeof(float) or sizeof(double)
+		char padding[32];       // the spectra start 64-byte aligned
+	};
+	static_assert(sizeof(Spectrum_cache_header) == 64, "spectrum cache header must be 64 bytes");
+
+	const char spectrum_cache_magic[8] = { 'D', 'M', 'I', 'M', 'G', 'S', 'P', '1' };
+
+	// 64-bit hash of the size and the pixels of the image, 8 bytes at a time
+	// (FNV-1a byte by byte took as long as loading the cached spectrum)
+	template <class T>
+	std::uint64_t image_hash(const CImg<T>& img) {
+		std::uint64_t hash = 14695981039346656037ull;
+		auto mix = [&](std::uint64_t word) {
+			hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+			hash ^= hash >> 32;
+		};
+		mix(std::uint64_t(img.width()) << 32 | std::uint32_t(img.height()));
+		mix(std::uint64_t(img.spectrum()));
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(img.data());
+		const size_t size = img.size() * sizeof(T);
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			std::uint64_t word;
+			std::memcpy(&word, bytes + i, 8);
+			mix(word);
+		}
+		std::uint64_t last = 0;
+		std::memcpy(&last, bytes + i, size - i);
+		mix(last ^ size);
+		return hash;
+	}
+
+	// mapping of a whole file: read only, or a new file of the given size mapped for writing
+	// (the scratch file of the out-of-core fft)
+	class Mapped_file {
+	public:
+		explicit Mapped_file(const std::string& path) {
+#ifdef _WIN32
+			file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file_ == INVALID_HANDLE_VALUE) dmimg::error("Can't open " + path);
+			LARGE_INTEGER file_size;
+			GetFileSizeEx(file_, &file_size);
+			size_ = size_t(file_size.QuadPart);
+			mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping_ == nullptr) { CloseHandle(file_); dmimg::error("Can't map " + path); }
+			data_ = static_cast<char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+			if (data_ == nullptr) { CloseHandle(mapping_); CloseHandle(file_); dmimg::error("Can't map " + path); }
+#else
+			const int file = ::open(path.c_str(), O_RDONLY);
+			if (file < 0) dmimg::error("Can't open " + path);
+			struct stat file_status;
+			if (fstat(file, &file_status) != 0 or file_status.st_size == 0) { ::close(file); dmimg::error("Can't map " + path); }
+			size_ = size_t(file_status.st_size);
+			void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, file, 0);
+			// the mapping stays valid without the descriptor
+			::close(file);
+			if (data == MAP_FAILED) dmimg::error("Can't map " + path);
+			data_ = static_cast<char*>(data);
+#endif
+		}
+		Mapped_file(const std::string& path, size_t size) : size_(size), writable_(true) {
+			if (size == 0) dmimg::error("Can't map an empty file " + path);
+#ifdef _WIN32
+			file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file_ == INVALID_HANDLE_VALUE) dmimg::error("Can't create " + path);
+			mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, DWORD(std::uint64_t(size) >> 32), DWORD(size & 0xffffffffu), nullptr);
+			if (mapping_ == nullptr) { CloseHandle(file_); dmimg::error("Can't map " + path); }
+			data_ = static_cast<char*>(MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, 0));
+			if (data_ == nullptr) { CloseHandle(mapping_); CloseHandle(file_); dmimg::error("Can't map " + path); }
+#else
+			const int file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+			if (file < 0) dmimg::error("Can't create " + path);
+			if (ftruncate(file, off_t(size)) != 0) { ::close(file); dmimg::error("Can't resize " + path); }
+			void* data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+			::close(file);
+			if (data == MAP_FAILED) dmimg::error("Can't map " + path);
+			data_ = static_cast<char*>(data);
+#endif
 		}
+		Mapped_file(const Mapped_file&) = delete;
+		Mapped_file& operator=(const Mapped_file&) = delete;
+		~Mapped_file() {
+#ifdef _WIN32
+			UnmapViewOfFile(data_);
+			CloseHandle(mapping_);
+			CloseHandle(file_);
+#else
+			munmap(data_, size_);
+#endif
+		}
+
+		const char* data() const { return data_; }
+		char* writable_data() {
+			if (!writable_) dmimg::error("the file is mapped read only");
+			return data_;
+		}
+		size_t size() const { return size_; }
+
+		// the pages of [offset, offset + size) are written out and dropped from the memory of the process,
+		// so a mapping much larger than the memory can be walked through
+		void release(size_t offset, size_t size) {
+#ifdef _WIN32
+			FlushViewOfFile(data_ + offset, size);
+#else
+			const size_t page = size_t(sysconf(_SC_PAGESIZE));
+			const size_t begin = offset / page * page;
+			const size_t end = std::min(size_, offset + size);
+			if (end <= begin) return;
+			if (writable_) msync(data_ + begin, end - begin, MS_ASYNC);
+			madvise(data_ + begin, end - begin, MADV_DONTNEED);
+#endif
+		}
+
+	private:
+		char* data_ = nullptr;
+		size_t size_ = 0;
+		bool writable_ = false;
+#ifdef _WIN32
+		HANDLE file_ = INVALID_HANDLE_VALUE;
+		HANDLE mapping_ = nullptr;
+#endif
+	};
+
+	// half spectra of the channels of an image, read from a mapped cache file or computed
+	// (and kept in memory), channel(c) is the half spectrum of channel c, width / 2 + 1 columns
+	template <class Real>
+	class Spectrum_source {
+	public:
+		Spectrum_source(int width, int height) : width_(width), height_(height) {}
+
+		int width() const { return width_; }
+		int height() const { return height_; }
+		int channels() const { return int(channels_.size()); }
+		const complex<Real>* channel(int c) const { return channels_[c]; }
+		bool from_cache() const { return file_ != nullptr; }
+
+		void add(Basic_complex_matrix<Real> half_spectrum) {
+			owned_.push_back(std::move(half_spectrum));
+			channels_.push_back(owned_.back().data());
+		}
+		void map(std::unique_ptr<Mapped_file> file, int channels) {
+			const size_t channel_size = size_t(width_ / 2 + 1) * height_;
+			const complex<Real>* data = reinterpret_cast<const complex<Real>*>(file->data() + sizeof(Spectrum_cache_header));
+			for (int c = 0; c < channels; c++) {
+				channels_.push_back(data + c * channel_size);
+			}
+			file_ = std::move(file);
+		}
+
+	private:
+		int width_;
+		int height_;
+		std::unique_ptr<Mapped_file> file_;
+		// a deque would do too, but the matrices are moved, so their data stays where it was
+		vector<Basic_complex_matrix<Real>> owned_;
+		vector<const complex<Real>*> channels_;
+	};
+
+	// cache file of the image hash, the precision and the number of channels
+	template <class Real>
+	std::string spectrum_cache_path(std::uint64_t hash, int channels) {
+		char name[64];
+		std::snprintf(name, sizeof(name), "%016llx_%s_%d.spectrum", static_cast<unsigned long long>(hash), std::is_same<Real, float>::value ? "float" : "double", channels);
+		return spectrum_cache_directory + "/" + name;
+	}
+
+	// name of a temporary file next to path, unique among the runs (processes) and the batch workers (threads)
+	// which may write the same cache file at once
+	std::string temporary_file_path(const std::string& path) {
+		static std::atomic<unsigned> counter{ 0 };
+#ifdef _WIN32
+		const unsigned long process = GetCurrentProcessId();
+#else
+		const unsigned long process = static_cast<unsigned long>(getpid());
+#endif
+		return path + "." + std::to_string(process) + "_" + std::to_string(counter++) + ".tmp";
+	}
+
+	// the spectra are written to a temporary file which is then renamed,
+	// so another run never maps a half written file
+	template <class Real>
+	void save_spectrum_cache(const std::string& path, std::uint64_t hash, const Spectrum_source<Real>& spectrum) {
+		Spectrum_cache_header header = {};
+		std::copy(spectrum_cache_magic, spectrum_cache_magic + 8, header.magic);
+		header.hash = hash;
+		header.width = spectrum.width();
+		header.height = spectrum.height();
+		header.channels = spectrum.channels();
+		header.real_size = sizeof(Real);
+		const std::string temporary_path = dmimg::temporary_file_path(path);
+		bool written = false;
+		{
+			std::ofstream file(temporary_path, std::ios::binary);
+			if (!file) dmimg::error("Can't write spectrum cache " + temporary_path);
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			const size_t channel_size = size_t(spectrum.width() / 2 + 1) * spectrum.height();
+			for (int c = 0; c < spectrum.channels(); c++) {
+				file.write(reinterpret_cast<const char*>(spectrum.channel(c)), channel_size * sizeof(complex<Real>));
+			}
+			written = bool(file.flush());
+		}
+		if (!written) {
+			std::remove(temporary_path.c_str());
+			dmimg::error("Can't write spectrum cache " + temporary_path);
+		}
+		std::remove(path.c_str());
+		if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+			std::remove(temporary_path.c_str());
+			// another worker renamed its copy of the same spectra there in between
+			if (!std::ifstream(path)) dmimg::error("Can't write spectrum cache " + path);
+		}
+	}
+
+	// maps the cache file if it exists and has the spectra of the image, otherwise returns false
+	// (a missing, truncated or unreadable file is a cache miss, the spectra are computed and the file written again)
+	template <class Real>
+	bool load_spectrum_cache(const std::string& path, std::uint64_t hash, int channels, Spectrum_source<Real>& spectrum) {
+		const size_t channel_size = size_t(spectrum.width() / 2 + 1) * spectrum.height();
+		std::error_code status;
+		const std::uintmax_t file_size = std::filesystem::file_size(path, status);
+		if (status or file_size != sizeof(Spectrum_cache_header) + channels * channel_size * sizeof(complex<Real>)) return false;
+		std::unique_ptr<Mapped_file> file;
+		try {
+			file = std::make_unique<Mapped_file>(path);
+		}
+		catch (const std::runtime_error&) {
+			return false;
+		}
+		if (file->size() != file_size) return false;
+		const Spectrum_cache_header& header = *reinterpret_cast<const Spectrum_cache_header*>(file->data());
+		if (!std::equal(spectrum_cache_magic, spectrum_cache_magic + 8, header.magic) or header.hash != hash or header.width != spectrum.width()
+			or header.height != spectrum.height() or header.channels != channels or header.real_size != int(sizeof(Real))) return false;
+		spectrum.map(std::move(file), channels);
+		return true;
+	}
+
+	// half spectra of the first channels of the image (1: red, 3: all of them),
+	// from the spectrum cache when it is on and has them, otherwise computed (and saved in the cache)
+	template <class Real, class T>
+	Spectrum_source<Real> image_spectrum(CImg<T>& input_img, int channels) {
+		Spectrum_source<Real> spectrum(input_img.width(), input_img.height());
+		std::uint64_t hash = 0;
+		std::string path;
+		if (!spectrum_cache_directory.empty()) {
+			hash = dmimg::image_hash(input_img);
+			path = dmimg::spectrum_cache_path<Real>(hash, channels);
+			if (dmimg::load_spectrum_cache(path, hash, channels, spectrum)) return spectrum;
+		}
+		for (int c = 0; c < channels; c++) {
+			spectrum.add(dmimg::fft_spatial_domain_half<Real>(input_img, c));
+		}
+		if (!path.empty()) dmimg::save_spectrum_cache(path, hash, spectrum);
+		return spectrum;
+	}
+
+	// filtered image from the spectrum, which is not changed, so one spectrum serves many filters
+	// (rounded as fft_inverse_2D_img_half, one channel gives a gray image)
+	template <class Real>
+	CImg<unsigned char> filter_spectrum_image(const Spectrum_source<Real>& spectrum, const Frequency_filter* filter) {
+		const int width = spectrum.width();
+		const int height = spectrum.height();
+		const Basic_fft_plan<Real>& plan = dmimg::get_fft_plan<Real>(width, height, Fft_direction::inverse);
+		Basic_complex_matrix<Real> samples_matrix(width / 2 + 1, height);
+		CImg<unsigned char> output(width, height, 1, 3);
+		for (int c = 0; c < spectrum.channels(); c++) {
+			plan.execute(samples_matrix, filter, spectrum.channel(c));
+			dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+				for (int y = y_begin; y < y_end; y++) {
+					const Real* samples = reinterpret_cast<const Real*>(samples_matrix.row(y));
+					for (int x = 0; x < width; x++) {
+						int value = int(std::abs(samples[x]) + 0.5);
+						if (spectrum.channels() == 1) dmimg::set_rgb_safe(output, x, y, value);
+						else output(x, y, 0, c) = dmimg::check_value(value);
+					}
+				}
+			});
+		}
+		return output;
+	}
+
+	// filter of a filter bank line: the name of the option without fft and its arguments,
+	// for example "lpf 40", "bpf 40 10", "hped 30 20 10 1"
+	std::unique_ptr<Frequency_filter> make_frequency_filter(const std::string& description, int width, int height) {
+		std::istringstream line(description);
+		std::string name;
+		line >> name;
+		vector<int> arguments;
+		int argument;
+		while (line >> argument) arguments.push_back(argument);
+		auto expect = [&](size_t count) {
+			if (arguments.size() != count) dmimg::error("filter " + name + ": expected " + std::to_string(count) + " arguments");
+		};
+		if (name == "hp") { expect(1); return std::make_unique<Radial_filter>(dmimg::make_high_pass_filter(width, height, arguments[0])); }
+		if (name == "lpf") { expect(1); return std::make_unique<Radial_filter>(dmimg::make_lowpass_filter(width, height, arguments[0])); }
+		if (name == "bpf") { expect(2); return std::make_unique<Radial_filter>(dmimg::make_bandpass_filter(width, height, arguments[0], arguments[1])); }
+		if (name == "bcf") { expect(2); return std::make_unique<Radial_filter>(dmimg::make_bandcut_filter(width, height, arguments[0], arguments[1])); }
+		if (name == "pmf") { expect(2); return std::make_unique<Phase_filter>(dmimg::make_phase_modifying_filter(width, height, arguments[0], arguments[1])); }
+		if (name == "hped") {
+			expect(4);
+			return std::make_unique<Wedge_filter>(dmimg::make_edge_detection_filter(width, height, arguments[0], arguments[1], arguments[2], arguments[3]));
+		}
+		dmimg::error("unknown filter " + name + " (hp, hped, pmf, lpf, bpf or bcf)");
+		return nullptr;
+	}
+
+	// the output file of filter i of a filter bank: name_i.extension
+	std::string filter_bank_output_path(const std::string& output_path, int i) {
+		size_t dot = output_path.find_last_of('.');
+		size_t slash = output_path.find_last_of("/\\");
+		if (dot == std::string::npos or (slash != std::string::npos and dot < slash)) dot = output_path.size();
+		return output_path.substr(0, dot) + "_" + std::to_string(i) + output_path.substr(dot);
+	}
+
+	// every filter applied to one spectrum of the image (in Real precision, all the channels in fft_color_mode),
+	// which is computed once or loaded from the spectrum cache
+	// is the filter Hermitian: M(-u, -v) = conj(M(u, v)), checked on its values (rows v and -v at once)
+	// only then the filtered spectrum of a real image is the spectrum of a real image and the half
+	// spectrum is enough, the inverse of the half spectrum would make any other filter symmetric
+	inline bool is_hermitian(const Frequency_filter& filter, int width, int height) {
+		vector<complex<double>> row(width);
+		vector<complex<double>> mirror(width);
+		for (int y = 0; y <= height / 2; y++) {
+			std::fill(row.begin(), row.end(), complex<double>(1.0, 0.0));
+			std::fill(mirror.begin(), mirror.end(), complex<double>(1.0, 0.0));
+			filter.apply(row.data(), 0, y, width);
+			filter.apply(mirror.data(), 0, (height - y) % height, width);
+			for (int x = 0; x < width; x++) {
+				if (std::abs(row[x] - std::conj(mirror[(width - x) % width])) > 1e-9) return false;
+			}
+		}
+		return true;
+	}
+
+	// filtering of the image with the full complex spectrum, for the filters which are not Hermitian
+	// (the edge detection wedge): the result is the magnitude of the complex inverse, as the previous
+	// full complex path, rounded as fft_inverse_2D_img
+	template <class Real, class T>
+	CImg<unsigned char> fft_filter_image_full(CImg<T>& input_img, const Frequency_filter& filter) {
+		const int width = input_img.width();
+		const int height = input_img.height();
+		const int channels = fft_color_mode ? 3 : 1;
+		CImg<unsigned char> output(width, height, 1, 3);
+		for (int c = 0; c < channels; c++) {
+			Basic_complex_matrix<Real> spectrum = dmimg::fft_spatial_domain<Real>(input_img, c);
+			dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+				for (int y = y_begin; y < y_end; y++) {
+					filter.apply(spectrum.row(y), 0, y, width);
+				}
+			});
+			dmimg::fft_inverse_2D(spectrum);
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					output(x, y, 0, c) = dmimg::check_value(int(std::abs(spectrum(x, y)) + 0.5));
+				}
+			}
+		}
+		if (channels == 1) dmimg::broadcast_plane(output);
 		return output;
 	}
 
-	// helper fuction
-	void print_complex_array(vector<vector<complex<double>>>& input) {
-		for (int y = 0; y < input.size(); y++) {
-			for (int x = 0; x < input[0].size(); x++) {
-				std::cerr << "abs: " << std::abs(input[y][x]) << " ";
+	template <class Real, class T>
+	vector<CImg<unsigned char>> fft_filter_bank_as(CImg<T>& input_img, const vector<std::unique_ptr<Frequency_filter>>& filters) {
+		Spectrum_source<Real> spectrum = dmimg::image_spectrum<Real>(input_img, fft_color_mode ? 3 : 1);
+		vector<CImg<unsigned char>> outputs;
+		for (const auto& filter : filters) {
+			if (!dmimg::is_hermitian(*filter, input_img.width(), input_img.height())) {
+				outputs.push_back(dmimg::fft_filter_image_full<Real>(input_img, *filter));
+			}
+			else outputs.push_back(dmimg::filter_spectrum_image(spectrum, filter.get()));
+		}
+		return outputs;
+	}
+
+	template <class T>
+	vector<CImg<unsigned char>> fft_filter_bank(CImg<T>& input_img, const vector<std::unique_ptr<Frequency_filter>>& filters) {
+		if (fft_precision_mode == Fft_precision::single_precision) {
+			return dmimg::fft_filter_bank_as<float>(input_img, filters);
+		}
+		return dmimg::fft_filter_bank_as<double>(input_img, filters);
+	}
+
+	// filtering of the image in the frequency domain in Real precision,
+	// all the channels in fft_color_mode, otherwise the red one
+	// with the spectrum cache on, the spectrum is loaded from it (or computed and saved there)
+	// filters which are not Hermitian need the full complex spectrum
+	template <class Real, class T>
+	CImg<unsigned char> fft_filter_image_as(CImg<T>& input_img, const Frequency_filter* filter) {
+		if (filter and !dmimg::is_hermitian(*filter, input_img.width(), input_img.height())) {
+			return dmimg::fft_filter_image_full<Real>(input_img, *filter);
+		}
+		if (!spectrum_cache_directory.empty()) {
+			return dmimg::filter_spectrum_image(dmimg::image_spectrum<Real>(input_img, fft_color_mode ? 3 : 1), filter);
+		}
+		if (fft_color_mode) {
+			Basic_color_spectrum<Real> spectrum = dmimg::fft_spatial_domain_color<Real>(input_img);
+			return dmimg::fft_inverse_2D_img_color(spectrum, filter);
+		}
+		Basic_complex_matrix<Real> half_spectrum = dmimg::fft_spatial_domain_half<Real>(input_img);
+		return dmimg::fft_inverse_2D_img_half(half_spectrum, filter);
+	}
+
+	// filtering of the image in the frequency domain in fft_precision_mode and fft_color_mode
+	template <class T>
+	CImg<unsigned char> fft_filter_image(CImg<T>& input_img, const Frequency_filter* filter) {
+		if (fft_precision_mode == Fft_precision::single_precision) {
+			return dmimg::fft_filter_image_as<float>(input_img, filter);
+		}
+		return dmimg::fft_filter_image_as<double>(input_img, filter);
+	}
+
+	// magnitude spectrum of the image in fft_precision_mode and fft_color_mode
+	template <class T>
+	CImg<unsigned char> fft_spectrum_image(CImg<T>& input_img) {
+		const Spectrum_view view = spectrum_view_mode;
+		const Spectrum_scale scale = spectrum_scale_mode;
+		if (fft_precision_mode == Fft_precision::single_precision) {
+			if (fft_color_mode) return dmimg::spectrum_image(dmimg::fft_spatial_domain_color<float>(input_img), view, scale);
+			return dmimg::spectrum_image(dmimg::fft_spatial_domain_half<float>(input_img), view, scale);
+		}
+		if (fft_color_mode) return dmimg::spectrum_image(dmimg::fft_spatial_domain_color(input_img), view, scale);
+		return dmimg::spectrum_image(dmimg::fft_spatial_domain_half(input_img), view, scale);
+	}
+
+	// export of the spectrum of the image (see spectrum export) in fft_precision_mode and fft_color_mode
+	template <class Real, class T>
+	void fft_export_spectrum_as(CImg<T>& input_img, const std::string& name) {
+		if (fft_color_mode) {
+			Basic_color_spectrum<Real> spectrum = dmimg::fft_spatial_domain_color<Real>(input_img);
+			dmimg::export_spectrum<Real>(name, { &spectrum[0], &spectrum[1], &spectrum[2] });
+		}
+		else {
+			Basic_complex_matrix<Real> half_spectrum = dmimg::fft_spatial_domain_half<Real>(input_img);
+			dmimg::export_spectrum<Real>(name, { &half_spectrum });
+		}
+	}
+
+	template <class T>
+	void fft_export_spectrum(CImg<T>& input_img, const std::string& name) {
+		if (fft_precision_mode == Fft_precision::single_precision) dmimg::fft_export_spectrum_as<float>(input_img, name);
+		else dmimg::fft_export_spectrum_as<double>(input_img, name);
+	}
+
+
+	// image registration
+	// translation of a frame against a reference by phase correlation: for a shifted frame,
+	// frame(x, y) = reference(x - dx, y - dy), the cross-power spectrum F * conj(R) / |F * conj(R)|
+	// is a pure phase ramp and its inverse fft is a single peak at (dx, dy)
+	// the images are made gray (mean of the channels), averaged in scale x scale blocks (registration_scale)
+	// and multiplied by a Hann window, so the borders, which don't wrap around, don't add a peak at zero shift
+	// the spectrum of the reference is computed once for a whole sequence of frames (Phase_correlator),
+	// a frame costs a forward fft, the cross-power spectrum (done by the first pass of the inverse fft)
+	// and the search of the peak
+
+	// block size of the averaging before the registration (--register_scale), 2 makes the transforms 4 times smaller,
+	// the peak is still found to a fraction of a block (the averaging also takes out some of the noise)
+	// 0: automatic, the smallest power of 2 leaving at most registration_max_size pixels on the longer side
+	int registration_scale = 0;
+	// 2048x2048 frames at scale 2 took 30 ms each on one core, at scale 1 about 100 ms
+	const int registration_max_size = 1024;
+
+	int automatic_registration_scale(int width, int height) {
+		int scale = 1;
+		while (std::max(width, height) / scale > registration_max_size) scale *= 2;
+		return scale;
+	}
+
+	struct Registration {
+		// shift of the frame against the reference, in pixels of the images
+		double dx = 0;
+		double dy = 0;
+		// height of the correlation peak: 1 for the reference shifted by whole pixels, near 0 for unrelated images
+		double response = 0;
+	};
+
+	// gray image (mean of the channels) averaged in scale x scale blocks, the width rounded down
+	// to even (as the real input fft needs) and multiplied by a Hann window
+	// the mean is not subtracted, it only changes the frequencies the phase correlator leaves out
+	// output is reused if it has the size already
+	template <class T>
+	void registration_image(const CImg<T>& img, int scale, CImg<float>& output) {
+		const int width = img.width() / scale / 2 * 2;
+		const int height = img.height() / scale;
+		if (width < 2 or height < 1) dmimg::error("the image is too small for the registration scale");
+		if (output.width() != width or output.height() != height or output.spectrum() != 1) output = CImg<float>(width, height, 1, 1);
+		// the averaging weight is in the window
+		const double block_weight = 1.0 / (double(scale) * scale * img.spectrum());
+		vector<float> window_x(width);
+		for (int x = 0; x < width; x++) window_x[x] = float(block_weight * (0.5 - 0.5 * std::cos(2 * value_pi_double * x / width)));
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			// sums of the rows of a block, all the channels: contiguous loops over a whole row
+			vector<float> row_sums(size_t(width) * scale);
+			float* sums = row_sums.data();
+			for (int y = y_begin; y < y_end; y++) {
+				std::fill(row_sums.begin(), row_sums.end(), 0.0f);
+				for (int c = 0; c < img.spectrum(); c++) {
+					for (int j = 0; j < scale; j++) {
+						const T* pixels = img.data(0, y * scale + j, 0, c);
+						for (int x = 0; x < width * scale; x++) sums[x] += float(pixels[x]);
+					}
+				}
+				float* row = output.data(0, y, 0, 0);
+				const float window_y = float(0.5 - 0.5 * std::cos(2 * value_pi_double * y / height));
+				if (scale == 1) {
+					for (int x = 0; x < width; x++) row[x] = sums[x] * window_x[x] * window_y;
+				}
+				else {
+					for (int x = 0; x < width; x++) {
+						float block = 0;
+						for (int i = 0; i < scale; i++) block += sums[x * scale + i];
+						row[x] = block * window_x[x] * window_y;
+					}
+				}
+			}
+		});
+	}
+
+	// multiplies the half spectrum of a frame by the whitened conj(R) / |R| of the reference
+	// and divides the products by their magnitudes
+	template <class Reference_real>
+	class Cross_power_filter : public Basic_frequency_filter<Cross_power_filter<Reference_real>> {
+	public:
+		explicit Cross_power_filter(const Basic_complex_matrix<Reference_real>& whitened_reference) : reference_(whitened_reference) {}
+
+		template <class Real>
+		void apply_values(complex<Real>* values, int x, int y, int count) const {
+			const Reference_real* reference = reinterpret_cast<const Reference_real*>(reference_.row(y) + x);
+			Real* parts = reinterpret_cast<Real*>(values);
+			for (int i = 0; i < 2 * count; i += 2) {
+				const Real re = parts[i] * Real(reference[i]) - parts[i + 1] * Real(reference[i + 1]);
+				const Real im = parts[i] * Real(reference[i + 1]) + parts[i + 1] * Real(reference[i]);
+				const Real squared = re * re + im * im;
+				// frequencies missing in the frame (or the reference) are left out
+				const Real scale = (squared > Real(1e-30)) ? Real(1) / std::sqrt(squared) : Real(0);
+				parts[i] = re * scale;
+				parts[i + 1] = im * scale;
+			}
+		}
+
+	private:
+		const Basic_complex_matrix<Reference_real>& reference_;
+	};
+
+	// position of the maximum between the samples left, center, right (center is the largest),
+	// -0.5 to 0.5 from the center, for the sinc shaped peak of the phase correlation:
+	// a shift of d pixels leaves center : side = (1 - d) : d next to the peak
+	inline double peak_offset(double left, double center, double right) {
+		if (right >= left) return (right > 0) ? right / (right + center) : 0.0;
+		return (left > 0) ? -left / (left + center) : 0.0;
+	}
+
+	// phase correlation of frames against one reference (see image registration),
+	// the spectrum of the reference and the fft plans are made in the constructor, the gray image
+	// and the spectrum of a frame are kept for the next one (so one correlator per thread)
+	template <class Real>
+	class Basic_phase_correlator {
+	public:
+		template <class T>
+		Basic_phase_correlator(const CImg<T>& reference, int scale = registration_scale)
+			: scale_(scale > 0 ? scale : dmimg::automatic_registration_scale(reference.width(), reference.height())),
+			image_width_(reference.width()), image_height_(reference.height()), filter_(reference_spectrum_) {
+			if (scale < 0) dmimg::error("registration scale can't be negative");
+			dmimg::registration_image(reference, scale_, gray_);
+			width_ = gray_.width();
+			height_ = gray_.height();
+			forward_ = &dmimg::get_fft_plan<Real>(width_, height_, Fft_direction::forward);
+			inverse_ = &dmimg::get_fft_plan<Real>(width_, height_, Fft_direction::inverse);
+			reference_spectrum_ = forward_->execute(gray_);
+			correlation_ = Basic_complex_matrix<Real>(width_ / 2 + 1, height_);
+			// conj(R) / |R|: the cross-power spectrum is the product with the frame spectrum,
+			// divided by its magnitude, which stays in the float range
+			dmimg::parallel_for(0, height_, [&](int y_begin, int y_end) {
+				for (int y = y_begin; y < y_end; y++) {
+					complex<Real>* row = reference_spectrum_.row(y);
+					for (int x = 0; x < reference_spectrum_.width(); x++) {
+						const Real magnitude = std::abs(row[x]);
+						row[x] = (magnitude > 0) ? std::conj(row[x]) / magnitude : complex<Real>(0);
+					}
+				}
+			});
+			// the mean of an image times the Hann window (3 coefficients in each direction) is only in
+			// u, v = -1, 0, 1, these frequencies are left out instead of subtracting the means of the images
+			for (int v : { 0, 1, height_ - 1 }) {
+				for (int u = 0; u < std::min(2, reference_spectrum_.width()); u++) reference_spectrum_(u, v % height_) = 0;
+			}
+		}
+
+		// the filter refers to the reference spectrum
+		Basic_phase_correlator(const Basic_phase_correlator&) = delete;
+		Basic_phase_correlator& operator=(const Basic_phase_correlator&) = delete;
+
+		int scale() const { return scale_; }
+
+		template <class T>
+		Registration register_frame(const CImg<T>& frame) {
+			if (frame.width() != image_width_ or frame.height() != image_height_) dmimg::error("the frame size is different from the reference size");
+			dmimg::registration_image(frame, scale_, gray_);
+			forward_->execute(gray_, correlation_);
+			inverse_->execute(correlation_, &filter_);
+			// the largest sample of every row, then of the rows
+			vector<std::pair<Real, int>> row_peaks(height_);
+			dmimg::parallel_for(0, height_, [&](int y_begin, int y_end) {
+				for (int y = y_begin; y < y_end; y++) {
+					const Real* samples = reinterpret_cast<const Real*>(correlation_.row(y));
+					row_peaks[y] = { samples[0], 0 };
+					for (int x = 1; x < width_; x++) {
+						if (samples[x] > row_peaks[y].first) row_peaks[y] = { samples[x], x };
+					}
+				}
+			});
+			int peak_y = 0;
+			for (int y = 1; y < height_; y++) {
+				if (row_peaks[y].first > row_peaks[peak_y].first) peak_y = y;
+			}
+			const int peak_x = row_peaks[peak_y].second;
+			auto sample = [&](int x, int y) {
+				return double(reinterpret_cast<const Real*>(correlation_.row((y + height_) % height_))[(x + width_) % width_]);
+			};
+			const double peak = sample(peak_x, peak_y);
+			double dx = peak_x + dmimg::peak_offset(sample(peak_x - 1, peak_y), peak, sample(peak_x + 1, peak_y));
+			double dy = peak_y + dmimg::peak_offset(sample(peak_x, peak_y - 1), peak, sample(peak_x, peak_y + 1));
+			// the correlation wraps around: the second half are negative shifts
+			if (dx > width_ / 2) dx -= width_;
+			if (dy > height_ / 2) dy -= height_;
+			Registration registration;
+			registration.dx = dx * scale_;
+			registration.dy = dy * scale_;
+			registration.response = peak;
+			return registration;
+		}
+
+	private:
+		int scale_;
+		int image_width_;
+		int image_height_;
+		int width_ = 0;
+		int height_ = 0;
+		const Basic_fft_plan<Real>* forward_ = nullptr;
+		const Basic_fft_plan<Real>* inverse_ = nullptr;
+		Basic_complex_matrix<Real> reference_spectrum_;
+		Cross_power_filter<Real> filter_;
+		CImg<float> gray_;
+		// the spectrum of the frame and then the correlation (in place)
+		Basic_complex_matrix<Real> correlation_;
+	};
+
+	// float: the position of the peak doesn't need more, and the transforms take half the time of double
+	using Phase_correlator = Basic_phase_correlator<float>;
+
+	// translation of the frame against the reference, see image registration
+	template <class T>
+	Registration register_image(const CImg<T>& reference, const CImg<T>& frame, int scale = registration_scale) {
+		return Phase_correlator(reference, scale).register_frame(frame);
+	}
+
+
+	// convolution with any kernel
+	// out(x, y) = sum of kernel(i, j) * img(x + i - center_x, y + j - center_y), the same orientation
+	// as conv_mask, pixels outside of the image are the nearest border pixels
+	// three ways to compute it, chosen by the estimated number of operations:
+	// - direct: width * height * kernel_width * kernel_height multiply-adds
+	// - separable (kernel = column * row): a pass along the rows and one along the columns,
+	//   width * height * (kernel_width + kernel_height)
+	// - fft, overlap-save: the image is cut into tiles of a fixed size, every tile is transformed,
+	//   multiplied by the spectrum of the kernel and transformed back, the tiles overlap by the kernel
+	//   size and only the part of a tile not affected by the wrap around is kept, so the memory
+	//   needed does not depend on the image size
+
+	enum class Convolution_method { automatic, direct, separable, fft };
+
+	// method of --convolve
+	Convolution_method convolution_method = Convolution_method::automatic;
+
+	// values[y * width + x], centered at (width / 2, height / 2)
+	struct Convolution_kernel {
+		int width = 0;
+		int height = 0;
+		vector<double> values;
+
+		double operator()(int x, int y) const { return values[static_cast<size_t>(y) * width + x]; }
+		int center_x() const { return width / 2; }
+		int center_y() const { return height / 2; }
+	};
+
+	Convolution_kernel make_kernel(int width, int height, const vector<double>& values) {
+		if (width < 1 or height < 1) dmimg::error("kernel size must be positive");
+		if (values.size() != size_t(width) * height) dmimg::error("kernel: expected " + std::to_string(width * height) + " values");
+		return { width, height, values };
+	}
+
+	// size x size, all the values 1 / size^2
+	Convolution_kernel make_box_kernel(int size) {
+		if (size < 1) dmimg::error("kernel size must be positive");
+		return dmimg::make_kernel(size, size, vector<double>(size_t(size) * size, 1.0 / (double(size) * size)));
+	}
+
+	// size x size gaussian with sigma = size / 6, normalized to sum 1
+	Convolution_kernel make_gaussian_kernel(int size) {
+		if (size < 1) dmimg::error("kernel size must be positive");
+		const double sigma = std::max(size / 6.0, 0.5);
+		vector<double> values(size_t(size) * size);
+		double sum = 0;
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				double dx = x - size / 2;
+				double dy = y - size / 2;
+				values[size_t(y) * size + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+				sum += values[size_t(y) * size + x];
 			}
 		}
+		for (double& value : values) value /= sum;
+		return dmimg::make_kernel(size, size, values);
 	}
 
-	bool is_power_of_two(int n)
-	{
-		return (std::ceil(log2(n)) == std::floor(log2(n)));
+	// text file: width and height, then width * height values row by row
+	Convolution_kernel load_kernel(const std::string& path) {
+		std::ifstream file(path);
+		if (!file) dmimg::error("Can't read kernel file " + path);
+		int width = 0, height = 0;
+		file >> width >> height;
+		if (!file or width < 1 or height < 1) dmimg::error("kernel file " + path + ": wrong size");
+		vector<double> values(size_t(width) * height);
+		for (double& value : values) {
+			if (!(file >> value)) dmimg::error("kernel file " + path + ": too few values");
+		}
+		return dmimg::make_kernel(width, height, values);
 	}
 
-	// changes quarters of the array of complex
-	shared_ptr<vector<vector<complex<double>>>> swap_quarters_ptr(vector<vector<complex<double>>>& original) {
-		auto output = std::make_shared<vector<vector<complex<double>>>>();
-
-		for (int x = 0; x < original.size(); x++) {
-			std::vector<std::complex<double>> column;
-			for (int y = 0; y < original.size(); y++) {
-				column.push_back(original[x][y]);
-			}
-			(*output).push_back(column); column.clear();
+	// kernel(x, y) = column[y] * row[x], false if the kernel has no such form
+	bool separate_kernel(const Convolution_kernel& kernel, vector<double>& column, vector<double>& row) {
+		// the row and the column through the largest value
+		size_t largest = 0;
+		for (size_t i = 1; i < kernel.values.size(); i++) {
+			if (std::abs(kernel.values[i]) > std::abs(kernel.values[largest])) largest = i;
 		}
-
-		for (int x = 0; x < original.size() / 2; x++) {
-			for (int y = 0; y < original[0].size() / 2; y++) {
-				std::swap((*output)[x][y], (*output)[original.size() / 2 + x][original[0].size() / 2 + y]);
-				std::swap((*output)[original.size() / 2 + x][y], (*output)[x][original[0].size() / 2 + y]);
+		const double pivot = kernel.values[largest];
+		if (pivot == 0) return false;
+		const int pivot_x = largest % kernel.width;
+		const int pivot_y = largest / kernel.width;
+		row.resize(kernel.width);
+		column.resize(kernel.height);
+		for (int x = 0; x < kernel.width; x++) row[x] = kernel(x, pivot_y);
+		for (int y = 0; y < kernel.height; y++) column[y] = kernel(pivot_x, y) / pivot;
+		const double tolerance = 1e-9 * std::abs(pivot);
+		for (int y = 0; y < kernel.height; y++) {
+			for (int x = 0; x < kernel.width; x++) {
+				if (std::abs(kernel(x, y) - column[y] * row[x]) > tolerance) return false;
 			}
 		}
+		return true;
+	}
 
-		return output;
+	// channel of the image with the border pixels repeated: left / top pixels before the image
+	// and right / bottom after it, (width + left + right) x (height + top + bottom)
+	template <class T>
+	vector<double> padded_plane(const CImg<T>& img, int channel, int left, int top, int right, int bottom) {
+		const int width = img.width() + left + right;
+		const int height = img.height() + top + bottom;
+		vector<double> plane(size_t(width) * height);
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				const int source_y = std::min(std::max(y - top, 0), img.height() - 1);
+				double* row = plane.data() + size_t(y) * width;
+				for (int x = 0; x < width; x++) {
+					row[x] = img(std::min(std::max(x - left, 0), img.width() - 1), source_y, 0, channel);
+				}
+			}
+		});
+		return plane;
 	}
 
-	// transforms CImg image to array of complex numbers
+	// the part of the padded plane needed by the kernel, see padded_plane
+	struct Padded_plane {
+		vector<double> values;
+		int width;
+		int height;
+	};
+
 	template <class T>
-	shared_ptr<vector<vector<complex<double>>>> image_to_complex(CImg<T>& input_img) {
-		auto output = std::make_shared<vector<vector<complex<double>>>>();
-		for (int y = 0; y < input_img.height(); y++) {
-			vector<complex<double>> temp;
-			for (int x = 0; x < input_img.width(); x++) {
-				temp.push_back(get_r(input_img, x, y));
+	Padded_plane pad_for_kernel(const CImg<T>& img, int channel, const Convolution_kernel& kernel) {
+		const int left = kernel.center_x();
+		const int top = kernel.center_y();
+		const int right = kernel.width - 1 - left;
+		const int bottom = kernel.height - 1 - top;
+		return { dmimg::padded_plane(img, channel, left, top, right, bottom), img.width() + kernel.width - 1, img.height() + kernel.height - 1 };
+	}
+
+	// out has width * height values, the padded plane has the kernel size - 1 more in both directions
+	void convolve_direct(const Padded_plane& plane, const Convolution_kernel& kernel, int width, int height, vector<double>& out) {
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				double* out_row = out.data() + size_t(y) * width;
+				std::fill(out_row, out_row + width, 0.0);
+				for (int j = 0; j < kernel.height; j++) {
+					const double* plane_row = plane.values.data() + size_t(y + j) * plane.width;
+					for (int i = 0; i < kernel.width; i++) {
+						const double value = kernel(i, j);
+						if (value == 0) continue;
+						// contiguous in x, the compiler vectorizes it
+						for (int x = 0; x < width; x++) {
+							out_row[x] += value * plane_row[x + i];
+						}
+					}
+				}
 			}
-			output->push_back(temp);
-		}
-		return output;
+		});
 	}
 
-	// fast Fourier transform with decimation in spatial domain
-	// we assume compatibility with grayscale images only
+	void convolve_separable(const Padded_plane& plane, const vector<double>& column, const vector<double>& row, int width, int height, vector<double>& out) {
+		const int kernel_width = row.size();
+		const int kernel_height = column.size();
+		// rows: width x plane.height
+		vector<double> horizontal(size_t(width) * plane.height);
+		dmimg::parallel_for(0, plane.height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				const double* plane_row = plane.values.data() + size_t(y) * plane.width;
+				double* horizontal_row = horizontal.data() + size_t(y) * width;
+				std::fill(horizontal_row, horizontal_row + width, 0.0);
+				for (int i = 0; i < kernel_width; i++) {
+					for (int x = 0; x < width; x++) {
+						horizontal_row[x] += row[i] * plane_row[x + i];
+					}
+				}
+			}
+		});
+		// columns, row by row so that memory is read contiguously
+		dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				double* out_row = out.data() + size_t(y) * width;
+				std::fill(out_row, out_row + width, 0.0);
+				for (int j = 0; j < kernel_height; j++) {
+					const double* horizontal_row = horizontal.data() + size_t(y + j) * width;
+					for (int x = 0; x < width; x++) {
+						out_row[x] += column[j] * horizontal_row[x];
+					}
+				}
+			}
+		});
+	}
 
-	void fast_fourier_1D(vector<complex<double>>& input) {
-		int size = input.size();
-		if (size <= 1) return;
+	// multiplies the half spectrum of a tile by the half spectrum of the kernel
+	class Spectrum_filter : public Basic_frequency_filter<Spectrum_filter> {
+	public:
+		explicit Spectrum_filter(const Complex_matrix& spectrum) : spectrum_(spectrum) {}
 
-		// divide
-		vector<complex<double>> even;
-		for (int i = 0; i < size; i = i + 2) {
-			even.push_back(input[i]);
-		}
-		vector<complex<double>> odd;
-		for (int i = 1; i < size; i = i + 2) {
-			odd.push_back(input[i]);
+		template <class Real>
+		void apply_values(complex<Real>* values, int x, int y, int count) const {
+			const complex<double>* row = spectrum_.row(y) + x;
+			for (int i = 0; i < count; i++) {
+				values[i] = complex<Real>(dmimg::complex_multiply(complex<double>(values[i]), row[i]));
+			}
 		}
 
-		// conquer
-		fast_fourier_1D(even);
-		fast_fourier_1D(odd);
+	private:
+		const Complex_matrix& spectrum_;
+	};
 
-		// combine the parts
-		for (int k = 0; k < size / 2; k++)
-		{
-			complex<double> t = std::polar(1.0, -2 * value_pi_double * k / size) * odd[k];
-			input[k] = even[k] + t;
-			input[k + size / 2] = even[k] - t;
+	// the largest fft tile, 512 x 512 doubles are 2 MB, the half spectrum as much
+	// (larger tiles don't fit in the cache and are slower per element)
+	const int fft_convolution_max_tile = 512;
+
+	// costs of the cost model in multiply-adds of the direct convolution, measured on 1920x1080:
+	// - every pixel of direct and separable costs about convolution_pixel_cost more (padding, rounding),
+	//   separable about separable_pixel_cost (the buffer between the passes)
+	// - a multiply-add of separable about separable_cost (it goes through memory twice)
+	// - a forward and inverse real input fft of a tile of n values about fft_convolution_cost * n * log2(n),
+	//   plus fft_convolution_tile_cost * n for copying the tile in and out
+	const double convolution_pixel_cost = 4.0;
+	const double separable_pixel_cost = 10.0;
+	const double separable_cost = 2.0;
+	const double fft_convolution_cost = 4.5;
+	const double fft_convolution_tile_cost = 4.0;
+
+	// tile size of overlap-save fft for one dimension: every tile keeps tile - kernel + 1 values
+	struct Fft_tiling {
+		int tile_width = 0;
+		int tile_height = 0;
+		int tiles_x = 0;
+		int tiles_y = 0;
+		double cost = 0;
+	};
+
+	// power of 2 tiles from twice the kernel size up to the one covering the whole image
+	// (or fft_convolution_max_tile), the one with the lowest estimated cost
+	Fft_tiling choose_fft_tiling(int width, int height, const Convolution_kernel& kernel) {
+		auto sizes = [](int image_size, int kernel_size) {
+			vector<int> result;
+			int size = 2;
+			while (size < 2 * kernel_size) size *= 2;
+			for (; ; size *= 2) {
+				if (size - kernel_size + 1 >= 1) result.push_back(size);
+				if (size - kernel_size + 1 >= image_size or size >= fft_convolution_max_tile) break;
+			}
+			return result;
+		};
+		Fft_tiling best;
+		best.cost = std::numeric_limits<double>::max();
+		for (int tile_width : sizes(width, kernel.width)) {
+			for (int tile_height : sizes(height, kernel.height)) {
+				Fft_tiling tiling;
+				tiling.tile_width = tile_width;
+				tiling.tile_height = tile_height;
+				const int step_x = tile_width - kernel.width + 1;
+				const int step_y = tile_height - kernel.height + 1;
+				tiling.tiles_x = (width + step_x - 1) / step_x;
+				tiling.tiles_y = (height + step_y - 1) / step_y;
+				const double n = double(tile_width) * tile_height;
+				tiling.cost = double(tiling.tiles_x) * tiling.tiles_y * (fft_convolution_cost * n * std::log2(n) + fft_convolution_tile_cost * n);
+				if (tiling.cost < best.cost) best = tiling;
+			}
 		}
+		return best;
 	}
 
-	void fast_fourier_2D(vector<vector<complex<double>>>& input) {
-		if (!(is_power_of_two(input.size()))) dmimg::error("Can't perfrom fft if height is not a power of 2.");
-		if (!(is_power_of_two(input[0].size()))) dmimg::error("Can't perfrom fft if width is not a power of 2.");
-		// perform rows
-		for (int row = 0; row < input.size(); row++) {
-			fast_fourier_1D(input[row]);
-		}
-		// perform columns
-		for (int column = 0; column < input[0].size(); column++) {
-			// gather one column and perform fft
-			vector<complex<double>> temp;
-			for (int y = 0; y < input.size(); y++) {
-				// read values into temp
-				temp.push_back(input[y][column]);
+	void convolve_fft(const Padded_plane& plane, const Convolution_kernel& kernel, const Fft_tiling& tiling, int width, int height, vector<double>& out) {
+		const int tile_width = tiling.tile_width;
+		const int tile_height = tiling.tile_height;
+		const int step_x = tile_width - kernel.width + 1;
+		const int step_y = tile_height - kernel.height + 1;
+		const Fft_plan& forward = dmimg::get_fft_plan(tile_width, tile_height, Fft_direction::forward);
+		const Fft_plan& inverse = dmimg::get_fft_plan(tile_width, tile_height, Fft_direction::inverse);
+		// circular convolution of a tile t with g gives sum of g(m) * t(n - m),
+		// g((-i) mod size) = kernel(i) turns it into sum of kernel(i) * t(n + i)
+		CImg<double> wrapped_kernel(tile_width, tile_height, 1, 1, 0.0);
+		for (int j = 0; j < kernel.height; j++) {
+			for (int i = 0; i < kernel.width; i++) {
+				wrapped_kernel((tile_width - i) % tile_width, (tile_height - j) % tile_height) = kernel(i, j);
 			}
-			fast_fourier_1D(temp);
-			// save fft of a column
-			for (int y = 0; y < input.size(); y++) {
-				input[y][column] = temp[y];
+		}
+		const Complex_matrix kernel_spectrum = forward.execute(wrapped_kernel);
+		const Spectrum_filter filter(kernel_spectrum);
+		// tiles are independent, each of them writes its own part of out
+		dmimg::parallel_for(0, tiling.tiles_x * tiling.tiles_y, [&](int tile_begin, int tile_end) {
+			CImg<double> tile(tile_width, tile_height, 1, 1);
+			for (int t = tile_begin; t < tile_end; t++) {
+				const int x0 = (t % tiling.tiles_x) * step_x;
+				const int y0 = (t / tiling.tiles_x) * step_y;
+				// the tile starts at (x0, y0) of the padded plane, past its end there are zeros
+				for (int y = 0; y < tile_height; y++) {
+					for (int x = 0; x < tile_width; x++) {
+						bool inside = x0 + x < plane.width and y0 + y < plane.height;
+						tile(x, y) = inside ? plane.values[size_t(y0 + y) * plane.width + x0 + x] : 0.0;
+					}
+				}
+				Complex_matrix spectrum = forward.execute(tile);
+				inverse.execute(spectrum, &filter);
+				for (int y = 0; y < step_y and y0 + y < height; y++) {
+					const double* samples = reinterpret_cast<const double*>(spectrum.row(y));
+					double* out_row = out.data() + size_t(y0 + y) * width;
+					for (int x = 0; x < step_x and x0 + x < width; x++) {
+						out_row[x0 + x] = samples[x];
+					}
+				}
 			}
+		});
+	}
+
+	// the method with the lowest estimated cost for the kernel and the image size
+	Convolution_method choose_convolution_method(int width, int height, const Convolution_kernel& kernel, bool separable) {
+		const double pixels = double(width) * height;
+		double best_cost = pixels * (kernel.width * kernel.height + convolution_pixel_cost);
+		Convolution_method best = Convolution_method::direct;
+		const double separable_total = pixels * (separable_cost * (kernel.width + kernel.height) + separable_pixel_cost);
+		if (separable and separable_total < best_cost) {
+			best_cost = separable_total;
+			best = Convolution_method::separable;
 		}
+		if (dmimg::choose_fft_tiling(width, height, kernel).cost < best_cost) {
+			best = Convolution_method::fft;
+		}
+		return best;
 	}
 
-	// takes input image and computes fast Fourier transform with decimation in spatial domain
-	// returns smart pointer of vector of vectors of complex numbers
-	template <class T>
-	shared_ptr<vector<vector<complex<double>>>> fft_spatial_domain(CImg<T>& input_img) {
-		auto output = std::make_shared<vector<vector<complex<double>>>>();
+	const char* convolution_method_name(Convolution_method method) {
+		switch (method) {
+		case Convolution_method::automatic: return "automatic";
+		case Convolution_method::direct: return "direct";
+		case Convolution_method::separable: return "separable";
+		case Convolution_method::fft: return "fft";
+		}
+		return "";
+	}
 
-		// check if width and height are a power of 2
-		if (!(is_power_of_two(input_img.width()))) dmimg::error("Can't perfrom fft if width is not a power of 2.");
-		if (!(is_power_of_two(input_img.height()))) dmimg::error("Can't perfrom fft if height is not a power of 2.");
+	// the method, the kernel factors and the tiles for a width x height output
+	struct Convolution_setup {
+		Convolution_method method;
+		vector<double> column;
+		vector<double> row;
+		Fft_tiling tiling;
+	};
 
-		// perform rows
-		for (int row = 0; row < input_img.height(); row++) {
-			vector<complex<double>> temp;
-			for (int x = 0; x < input_img.width(); x++) {
-				temp.push_back(get_r(input_img, x, row));
-			}
-			fast_fourier_1D(temp);
-			output->push_back(temp);
+	// automatic chooses the method, separable needs a separable kernel
+	Convolution_setup setup_convolution(int width, int height, const Convolution_kernel& kernel, Convolution_method method) {
+		Convolution_setup setup;
+		const bool separable = dmimg::separate_kernel(kernel, setup.column, setup.row);
+		if (method == Convolution_method::automatic) method = dmimg::choose_convolution_method(width, height, kernel, separable);
+		if (method == Convolution_method::separable and !separable) dmimg::error("the kernel is not separable");
+		setup.method = method;
+		if (method == Convolution_method::fft) setup.tiling = dmimg::choose_fft_tiling(width, height, kernel);
+		return setup;
+	}
+
+	// convolution of a padded plane, out has width * height values
+	void convolve_plane(const Padded_plane& plane, const Convolution_kernel& kernel, const Convolution_setup& setup, int width, int height, vector<double>& out) {
+		switch (setup.method) {
+		case Convolution_method::separable:
+			dmimg::convolve_separable(plane, setup.column, setup.row, width, height, out);
+			break;
+		case Convolution_method::fft:
+			dmimg::convolve_fft(plane, kernel, setup.tiling, width, height, out);
+			break;
+		default:
+			dmimg::convolve_direct(plane, kernel, width, height, out);
 		}
-		// perform columns
-		for (int column = 0; column < input_img.width(); column++) {
-			// gather one column and perform fft
-			vector<complex<double>> temp;
-			for (int y = 0; y < input_img.height(); y++) {
-				// read values into temp
-				temp.push_back((*output)[y][column]);
-			}
-			// do fft
-			fast_fourier_1D(temp);
-			// save fft into output
-			for (int y = 0; y < input_img.height(); y++) {
-				// read values into temp
-				(*output)[y][column] = temp[y];
+	}
+
+	// rounded values of out in channel c of the image
+	template <class T>
+	void store_convolution(CImg<T>& img, int c, const vector<double>& out) {
+		const int width = img.width();
+		dmimg::parallel_for(0, img.height(), [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				for (int x = 0; x < width; x++) {
+					img(x, y, 0, c) = dmimg::check_value(int(std::floor(out[size_t(y) * width + x] + 0.5)));
+				}
 			}
+		});
+	}
+
+	// convolution of every channel of the image with the kernel, the result is rounded
+	// automatic chooses the method, separable needs a separable kernel
+	// returns the method used
+	template <class T>
+	Convolution_method convolve(CImg<T>& img, const Convolution_kernel& kernel, Convolution_method method = Convolution_method::automatic) {
+		const int width = img.width();
+		const int height = img.height();
+		const Convolution_setup setup = dmimg::setup_convolution(width, height, kernel, method);
+		vector<double> out(size_t(width) * height);
+		for (int c = 0; c < img.spectrum(); c++) {
+			dmimg::convolve_plane(dmimg::pad_for_kernel(img, c, kernel), kernel, setup, width, height, out);
+			dmimg::store_convolution(img, c, out);
 		}
+		return setup.method;
+	}
 
-		return output;
+	// out-of-core operations
+	// images larger than the memory are read and written a band of rows at a time (uncompressed bmp,
+	// or binary ppm, which has no 4 GB limit),
+	// the memory used stays under memory_limit (--mem-limit):
+	// - convolution (bounded support): bands of output rows, each one needs only the input rows
+	//   under the kernel, they are convolved like a whole image (with the fft the tiles are overlap-save)
+	// - fft filters (global): two passes, the row transforms go to a memory mapped scratch file, then
+	//   blocks of columns are transformed forward, filtered and transformed back in it, and the inverse
+	//   row transforms make the output bands
+
+	// memory for the bands and the blocks of the out-of-core operations, in bytes
+	size_t memory_limit = size_t(1024) << 20;
+
+	// little endian numbers of the bmp headers
+	inline std::uint32_t read_le(const unsigned char* bytes, int count) {
+		std::uint32_t value = 0;
+		for (int i = count - 1; i >= 0; i--) value = value << 8 | bytes[i];
+		return value;
+	}
+	inline void write_le(unsigned char* bytes, std::uint32_t value, int count) {
+		for (int i = 0; i < count; i++, value >>= 8) bytes[i] = static_cast<unsigned char>(value & 0xff);
 	}
 
-	void fft_inverse_2D(vector<vector<complex<double>>>& input) {
-		// check if dimensions are a power of 2
-		if (!(is_power_of_two(input.size()))) dmimg::error("Can't perfrom fft if height is not a power of 2.");
-		if (!(is_power_of_two(input[0].size()))) dmimg::error("Can't perfrom fft if width is not a power of 2.");
+	// is the file a ppm (by the extension), otherwise it is a bmp
+	inline bool is_ppm_path(const std::string& path) {
+		std::string extension = std::filesystem::path(path).extension().string();
+		for (char& c : extension) c = char(std::tolower(static_cast<unsigned char>(c)));
+		return extension == ".ppm";
+	}
 
-		// conjugate the complex numbers for the first time
-		for (int y = 0; y < input.size(); y++) {
-			for (int x = 0; x < input[0].size(); x++) {
-				input[y][x] = std::conj(input[y][x]);
+	// image read a band of rows at a time: uncompressed bmp (24-bit, or 8-bit with a palette)
+	// or binary ppm (P6, 8 bits a sample)
+	class Band_reader {
+	public:
+		explicit Band_reader(const std::string& path) : file_(path, std::ios::binary) {
+			if (!file_) dmimg::error("Can't read " + path);
+			if (file_.peek() == 'P') {
+				this->read_ppm_header(path);
+				return;
+			}
+			unsigned char header[54];
+			if (!file_.read(reinterpret_cast<char*>(header), sizeof(header)) or header[0] != 'B' or header[1] != 'M') dmimg::error(path + " is not a bmp or a binary ppm file");
+			data_offset_ = dmimg::read_le(header + 10, 4);
+			const std::uint32_t info_size = dmimg::read_le(header + 14, 4);
+			width_ = int(dmimg::read_le(header + 18, 4));
+			const std::int32_t height = std::int32_t(dmimg::read_le(header + 22, 4));
+			bits_ = int(dmimg::read_le(header + 28, 2));
+			const std::uint32_t compression = dmimg::read_le(header + 30, 4);
+			// a negative height: the rows are stored from the top
+			bottom_up_ = height > 0;
+			height_ = std::abs(height);
+			if (width_ < 1 or height_ < 1) dmimg::error(path + ": wrong bmp size");
+			if (compression != 0 or (bits_ != 24 and bits_ != 8)) dmimg::error(path + ": only uncompressed 24-bit and 8-bit bmp can be read out-of-core");
+			if (bits_ == 8) {
+				std::uint32_t colors = dmimg::read_le(header + 46, 4);
+				if (colors == 0 or colors > 256) colors = 256;
+				palette_.assign(256 * 4, 0);
+				file_.seekg(14 + info_size);
+				file_.read(reinterpret_cast<char*>(palette_.data()), colors * 4);
 			}
+			row_size_ = (size_t(width_) * bits_ / 8 + 3) / 4 * 4;
+			row_buffer_.resize(row_size_);
 		}
-		// forward fft
-		fast_fourier_2D(input);
 
-		// conjugate the complex numbers again
-		for (int y = 0; y < input.size(); y++) {
-			for (int x = 0; x < input[0].size(); x++) {
-				input[y][x] = std::conj(input[y][x]);
+		int width() const { return width_; }
+		int height() const { return height_; }
+
+		// rows y_begin .. y_end - 1 of the image (rgb), row y goes to row y - y_begin of the band
+		void read_rows(int y_begin, int y_end, CImg<unsigned char>& band) {
+			if (band.width() != width_ or band.height() < y_end - y_begin or band.spectrum() != 3) band.assign(width_, y_end - y_begin, 1, 3);
+			for (int y = y_begin; y < y_end; y++) {
+				this->read_row(y, band, y - y_begin);
 			}
 		}
-		// scale the numbers properly
-		double sizes_multiplied = input.size() * input[0].size();
-		for (int y = 0; y < input.size(); y++) {
-			for (int x = 0; x < input[0].size(); x++) {
-				input[y][x] = input[y][x] / sizes_multiplied;
+
+		// row y of the image to row band_y of the band
+		void read_row(int y, CImg<unsigned char>& band, int band_y) {
+			const int stored_y = bottom_up_ ? height_ - 1 - y : y;
+			file_.seekg(std::streamoff(data_offset_) + std::streamoff(stored_y) * std::streamoff(row_size_));
+			if (!file_.read(reinterpret_cast<char*>(row_buffer_.data()), row_size_)) dmimg::error("bmp file is too short");
+			for (int x = 0; x < width_; x++) {
+				// bgr (ppm: rgb), in the palette bgr0
+				const unsigned char* pixel = (bits_ == 24) ? &row_buffer_[size_t(x) * 3] : &palette_[size_t(row_buffer_[x]) * 4];
+				band(x, band_y, 0, 0) = pixel[rgb_ ? 0 : 2];
+				band(x, band_y, 0, 1) = pixel[1];
+				band(x, band_y, 0, 2) = pixel[rgb_ ? 2 : 0];
 			}
 		}
-	}
 
-	// takes a table of complex numbers, performs inverse fft and returns an image
-	// input is not a reference because we need to modify (we need a copy) it to get an image
-	CImg<unsigned char> fft_inverse_2D_img(vector<vector<complex<double>>> input) {
-		fft_inverse_2D(input);
-		CImg<unsigned char> output(input[0].size(), input.size(), 1, 3);
-		for (int y = 0; y < input.size(); y++) {
-			for (int x = 0; x < input[0].size(); x++) {
-				dmimg::set_rgb_safe(output, x, y, int(std::abs(input[y][x])));
-			}
+	private:
+		// "P6 width height 255" and one whitespace, the rows follow from the top
+		void read_ppm_header(const std::string& path) {
+			if (file_.get() != 'P' or file_.get() != '6') dmimg::error(path + " is not a bmp or a binary ppm file");
+			width_ = this->read_ppm_number(path);
+			height_ = this->read_ppm_number(path);
+			if (this->read_ppm_number(path) != 255) dmimg::error(path + ": only ppm files with 8-bit samples can be read out-of-core");
+			if (width_ < 1 or height_ < 1) dmimg::error(path + ": wrong ppm size");
+			data_offset_ = std::uint64_t(file_.tellg());
+			bits_ = 24;
+			rgb_ = true;
+			bottom_up_ = false;
+			row_size_ = size_t(width_) * 3;
+			row_buffer_.resize(row_size_);
 		}
-		return output;
-	}
 
-	// filters
+		// number of the ppm header with the whitespace after it, comments (# to the end of the line) are skipped
+		int read_ppm_number(const std::string& path) {
+			int c = file_.get();
+			while (c == '#' or std::isspace(c)) {
+				if (c == '#') while (c != '\n' and c != EOF) c = file_.get();
+				c = file_.get();
+			}
+			if (!std::isdigit(c)) dmimg::error(path + ": wrong ppm header");
+			long long value = 0;
+			for (; std::isdigit(c); c = file_.get()) {
+				value = value * 10 + (c - '0');
+				if (value > std::numeric_limits<int>::max()) dmimg::error(path + ": wrong ppm header");
+			}
+			if (!std::isspace(c)) dmimg::error(path + ": wrong ppm header");
+			return int(value);
+		}
 
-	shared_ptr<vector<vector<complex<double>>>> high_pass_filter_mask(int width, int height, double band_size) {
-		auto mask = std::make_shared<vector<vector<complex<double>>>>();
+		std::ifstream file_;
+		int width_ = 0;
+		int height_ = 0;
+		int bits_ = 0;
+		bool rgb_ = false;
+		bool bottom_up_ = true;
+		std::uint64_t data_offset_ = 0;
+		size_t row_size_ = 0;
+		vector<unsigned char> palette_;
+		vector<unsigned char> row_buffer_;
+	};
 
-		int half_width = width / 2;
-		int half_height = height / 2;
-		double one = 1;
-		double zero = 0;
+	// image written a band of rows at a time (in any order): binary ppm when the path ends with .ppm,
+	// otherwise 24-bit bmp, which can't be larger than 4 GB (its header has 32-bit sizes),
+	// the file is removed again if it is not finished (an error on the way leaves no partial image)
+	class Band_writer {
+	public:
+		Band_writer(const std::string& path, int width, int height) : path_(path), ppm_(dmimg::is_ppm_path(path)), width_(width), height_(height) {
+			if (ppm_) {
+				row_size_ = size_t(width) * 3;
+				const std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+				header_size_ = header.size();
+				file_.open(path, std::ios::binary | std::ios::trunc);
+				if (!file_) dmimg::error("Can't write " + path);
+				file_.write(header.data(), header.size());
+				row_buffer_.assign(row_size_, 0);
+				return;
+			}
+			row_size_ = (size_t(width) * 3 + 3) / 4 * 4;
+			const std::uint64_t file_size = 54 + std::uint64_t(row_size_) * height;
+			// checked before the file is created
+			if (file_size > 0xffffffffull) dmimg::error(path + ": the image is too large for a bmp file (4 GB), write it as .ppm");
+			file_.open(path, std::ios::binary | std::ios::trunc);
+			if (!file_) dmimg::error("Can't write " + path);
+			unsigned char header[54] = { 'B', 'M' };
+			dmimg::write_le(header + 2, std::uint32_t(file_size), 4);
+			dmimg::write_le(header + 10, 54, 4);
+			dmimg::write_le(header + 14, 40, 4);
+			dmimg::write_le(header + 18, std::uint32_t(width), 4);
+			dmimg::write_le(header + 22, std::uint32_t(height), 4);
+			dmimg::write_le(header + 26, 1, 2);
+			dmimg::write_le(header + 28, 24, 2);
+			dmimg::write_le(header + 34, std::uint32_t(row_size_ * height), 4);
+			file_.write(reinterpret_cast<const char*>(header), sizeof(header));
+			row_buffer_.assign(row_size_, 0);
+		}
+		Band_writer(const Band_writer&) = delete;
+		Band_writer& operator=(const Band_writer&) = delete;
+		~Band_writer() {
+			if (finished_) return;
+			file_.close();
+			std::remove(path_.c_str());
+		}
 
-		for (int y = 0; y < height; y++) {
-			vector<complex<double>> temp_row;
-			for (int x = 0; x < width; x++) {
-				// distance to point
-				int distance = std::sqrt((x - half_width) * (x - half_width) + (y - half_height) * (y - half_height));
-				if (distance > band_size) {
-					temp_row.push_back(one);
-				}
-				else {
-					temp_row.push_back(zero);
+		// rows of the band (all of them) as rows y_begin.. of the image
+		void write_rows(int y_begin, const CImg<unsigned char>& band, int rows_count) {
+			for (int band_y = 0; band_y < rows_count; band_y++) {
+				for (int x = 0; x < width_; x++) {
+					row_buffer_[size_t(x) * 3] = band(x, band_y, 0, ppm_ ? 0 : 2);
+					row_buffer_[size_t(x) * 3 + 1] = band(x, band_y, 0, 1);
+					row_buffer_[size_t(x) * 3 + 2] = band(x, band_y, 0, ppm_ ? 2 : 0);
 				}
+				// the rows of a bmp are stored from the bottom (bgr), of a ppm from the top (rgb)
+				const int stored_y = ppm_ ? y_begin + band_y : height_ - 1 - (y_begin + band_y);
+				file_.seekp(std::streamoff(header_size_) + std::streamoff(stored_y) * std::streamoff(row_size_));
+				file_.write(reinterpret_cast<const char*>(row_buffer_.data()), row_size_);
 			}
-			mask->push_back(temp_row);
+			if (!file_) dmimg::error("Can't write " + path_);
 		}
-		return mask;
-	}
 
-	void high_pass_filter(vector<vector<complex<double>>>& input, int band_size) {
-		shared_ptr<vector<vector<complex<double>>>> mask = high_pass_filter_mask(input[0].size(), input.size(), band_size);
-		for (int y = 0; y < input.size(); y++) {
-			for (int x = 0; x < input[0].size(); x++) {
-				input[y][x] = input[y][x] * (*mask)[y][x];
-				//std::cerr << (*mask)[y][x] << " ";
+		// all the rows are written, the file is kept
+		void finish() {
+			file_.close();
+			if (!file_) dmimg::error("Can't write " + path_);
+			finished_ = true;
+		}
+
+	private:
+		std::string path_;
+		std::ofstream file_;
+		bool finished_ = false;
+		bool ppm_;
+		int width_;
+		int height_;
+		size_t header_size_ = 54;
+		size_t row_size_ = 0;
+		vector<unsigned char> row_buffer_;
+	};
+
+	// convolution of an image file larger than the memory, bands of output rows are computed one by one
+	// returns the method used
+	Convolution_method convolve_out_of_core(const std::string& source_path, const std::string& output_path, const Convolution_kernel& kernel, Convolution_method method) {
+		Band_reader reader(source_path);
+		const int width = reader.width();
+		const int height = reader.height();
+		const int padded_width = width + kernel.width - 1;
+		// memory of one row of a band: the input row (3 bytes a pixel), the padded plane,
+		// the result, the buffer of separable and the output row
+		const size_t row_memory = size_t(width) * 3 + size_t(padded_width) * sizeof(double) + 2 * size_t(width) * sizeof(double) + size_t(width) * 3;
+		// the rows above and below the band
+		size_t fixed_memory = size_t(kernel.height - 1) * row_memory;
+		if (memory_limit <= fixed_memory + row_memory) dmimg::error("the memory limit is too small for the kernel and the image width");
+		// the method is chosen for the highest band that fits without the fft tiles,
+		// only fft adds the tiles of every thread and the kernel spectrum
+		const int highest_band = int(std::min<size_t>(height, (memory_limit - fixed_memory) / row_memory));
+		method = dmimg::setup_convolution(width, highest_band, kernel, method).method;
+		if (method == Convolution_method::fft) {
+			fixed_memory += size_t(dmimg::thread_pool().size() + 1) * 3 * fft_convolution_max_tile * fft_convolution_max_tile * sizeof(double);
+			if (memory_limit <= fixed_memory + row_memory) dmimg::error("the memory limit is too small for the fft tiles, the kernel and the image width");
+		}
+		const int band_height = int(std::min<size_t>(height, (memory_limit - fixed_memory) / row_memory));
+		const Convolution_setup setup = dmimg::setup_convolution(width, band_height, kernel, method);
+		const int top = kernel.center_y();
+		// created once the limits are checked
+		Band_writer writer(output_path, width, height);
+		CImg<unsigned char> input_band(width, band_height + kernel.height - 1, 1, 3);
+		CImg<unsigned char> output_band(width, band_height, 1, 3);
+		vector<double> out(size_t(width) * band_height);
+		for (int y0 = 0; y0 < height; y0 += band_height) {
+			const int rows = std::min(band_height, height - y0);
+			// the input rows under the kernel, with the first and the last row repeated outside of the image
+			for (int j = 0; j < rows + kernel.height - 1; j++) {
+				reader.read_row(std::min(std::max(y0 - top + j, 0), height - 1), input_band, j);
+			}
+			for (int c = 0; c < 3; c++) {
+				Padded_plane plane;
+				plane.width = padded_width;
+				plane.height = rows + kernel.height - 1;
+				plane.values = dmimg::padded_plane(input_band, c, kernel.center_x(), 0, kernel.width - 1 - kernel.center_x(), 0);
+				plane.values.resize(size_t(plane.width) * plane.height);
+				dmimg::convolve_plane(plane, kernel, setup, width, rows, out);
+				dmimg::store_convolution(output_band, c, out);
 			}
+			writer.write_rows(y0, output_band, rows);
 		}
+		writer.finish();
+		return setup.method;
 	}
 
-	shared_ptr<vector<vector<complex<double>>>> high_pass_edge_detection_filter_mask(int width, int height, int angle, int detection_width, int radius, bool zeroAtXaxxis) {
-		auto mask = std::make_shared<vector<vector<complex<double>>>>();
-		if (!(-45 <= angle and angle <= 45)) dmimg::error("invalid angle: required range <-45,45>");
-		if (!(0 < detection_width and detection_width < 90)) dmimg::error("invalid width: required range (-90,90)");
-		// radius is not checked as we run through all positions and check if they belong or not to the circle
+	// rows of the scratch file copied to or from a block of columns before they are released
+	const int out_of_core_release_rows = 64;
 
-		int half_width = width / 2;
-		int half_height = height / 2;
-		double one = 1;
-		double zero = 0;
-		// precision of mask calculation, for very high resolution images the value should be lowered
-		double mask_precision = 0.001;
+	// path of a file which is removed at the end of the scope, on an error too
+	class Temporary_file {
+	public:
+		explicit Temporary_file(std::string path) : path_(std::move(path)) {}
+		Temporary_file(const Temporary_file&) = delete;
+		Temporary_file& operator=(const Temporary_file&) = delete;
+		~Temporary_file() { std::remove(path_.c_str()); }
 
-		// initialize the mask
-		for (int y = 0; y < height; y++) {
-			vector<complex<double>> temp_row;
-			for (int x = 0; x < width; x++) {
-				temp_row.push_back(zero);
-			}
-			mask->push_back(temp_row);
-		}
+		const std::string& path() const { return path_; }
 
-		double angle_base = (angle)*value_pi_double / 180.0;
-		double a_min = std::tan(angle_base - (detection_width / 2) * value_pi_double / 180.0);
-		double a_max = std::tan(angle_base + (detection_width / 2) * value_pi_double / 180.0);
+	private:
+		std::string path_;
+	};
 
-		if (zeroAtXaxxis == true) {
-			for (double a = a_min; a < a_max; a += mask_precision) {
-				// do the function for parameter a
-				for (int x = 0; x < width; x++) {
-					double y_double = a * (x - half_width) + half_height;
-					int y = int(y_double);
-					if (0 <= y and y < height) {
-						(*mask)[y][x] = one;
-					}
+	// fft filter of an image file larger than the memory (in Real precision, channels: 1 red, 3 all),
+	// the half spectra go through a memory mapped scratch file, which is removed at the end (on an error too),
+	// all the memory limits are checked before the scratch file and the output are created
+	template <class Real>
+	void fft_filter_out_of_core_as(const std::string& source_path, const std::string& output_path, const Frequency_filter* filter, int channels) {
+		Band_reader reader(source_path);
+		const int width = reader.width();
+		const int height = reader.height();
+		if (width < 2 or width % 2 != 0) dmimg::error("Can't perfrom real input fft if width is odd.");
+		if (filter and !dmimg::is_hermitian(*filter, width, height)) dmimg::error("the filter is not Hermitian, it needs the full spectrum, which out-of-core filtering doesn't keep");
+		const int half_width = width / 2 + 1;
+		const size_t channel_size = size_t(half_width) * height;
+		const Basic_fft_tables<Real>& half_row_tables = dmimg::get_fft_tables<Real>(width / 2);
+		const Basic_fft_tables<Real>& full_row_tables = dmimg::get_fft_tables<Real>(width);
+		const Basic_fft_tables<Real>& column_tables = dmimg::get_fft_tables<Real>(height);
+		// a band of rows: the image rows (in and out) and the rows of the scratch file
+		const size_t row_memory = 2 * size_t(width) * 3 + channels * size_t(half_width) * sizeof(complex<Real>);
+		if (memory_limit < 2 * row_memory) dmimg::error("the memory limit is too small for the image width");
+		const int band_height = int(std::min<size_t>(height, memory_limit / row_memory));
+		// a block of columns: the block and the pages of the scratch file mapped while it is copied,
+		// the system maps up to 64 kB around every page read, the rows are released every
+		// out_of_core_release_rows, so that is at most release_memory
+		const size_t release_memory = size_t(out_of_core_release_rows) * (64 << 10);
+		const size_t column_memory = size_t(height) * sizeof(complex<Real>);
+		if (memory_limit < release_memory + column_memory) dmimg::error("the memory limit is too small for the image height");
+		const int block_width = int(std::min<size_t>(half_width, (memory_limit - release_memory) / column_memory));
+		// removed after the mapping is closed
+		const Temporary_file scratch_file(output_path + ".scratch");
+		{
+			Mapped_file scratch(scratch_file.path(), channels * channel_size * sizeof(complex<Real>));
+			complex<Real>* spectra = reinterpret_cast<complex<Real>*>(scratch.writable_data());
+			CImg<unsigned char> band(width, band_height, 1, 3);
+
+			// rows, forward
+			for (int y0 = 0; y0 < height; y0 += band_height) {
+				const int rows = std::min(band_height, height - y0);
+				reader.read_rows(y0, y0 + rows, band);
+				for (int c = 0; c < channels; c++) {
+					dmimg::parallel_for(0, rows, [&](int y_begin, int y_end) {
+						for (int y = y_begin; y < y_end; y++) {
+							complex<Real>* row = spectra + c * channel_size + size_t(y0 + y) * half_width;
+							Real* samples = reinterpret_cast<Real*>(row);
+							for (int x = 0; x < width; x++) {
+								samples[x] = band(x, y, 0, c);
+							}
+							dmimg::fft_real_row(row, half_row_tables, full_row_tables);
+						}
+					});
+					scratch.release((c * channel_size + size_t(y0) * half_width) * sizeof(complex<Real>), size_t(rows) * half_width * sizeof(complex<Real>));
 				}
 			}
-		}
-		else // we need to take the y axis as base
-		{
-			for (double a = a_min; a < a_max; a += mask_precision) {
-				// do the function for parameter a
-				for (int y = 0; y < height; y++) {
-					double x_double = a * (y - half_height) + half_width;
-					int x = int(x_double);
-					if (0 <= x and x < width) {
-						(*mask)[y][x] = one;
+
+			// columns: forward, filter, inverse, a block of columns at a time
+			Basic_complex_matrix<Real> block(block_width, height);
+			for (int c = 0; c < channels; c++) {
+				complex<Real>* spectrum = spectra + c * channel_size;
+				for (int x0 = 0; x0 < half_width; x0 += block_width) {
+					const int columns = std::min(block_width, half_width - x0);
+					if (columns != block.width()) {
+						// the previous block is freed before the last (narrower) one is made
+						block = Basic_complex_matrix<Real>();
+						block = Basic_complex_matrix<Real>(columns, height);
+					}
+					for (int y0 = 0; y0 < height; y0 += out_of_core_release_rows) {
+						const int rows = std::min(out_of_core_release_rows, height - y0);
+						dmimg::parallel_for(y0, y0 + rows, [&](int y_begin, int y_end) {
+							for (int y = y_begin; y < y_end; y++) {
+								std::copy(spectrum + size_t(y) * half_width + x0, spectrum + size_t(y) * half_width + x0 + columns, block.row(y));
+							}
+						});
+						scratch.release((c * channel_size + size_t(y0) * half_width) * sizeof(complex<Real>), size_t(rows) * half_width * sizeof(complex<Real>));
+					}
+					dmimg::fft_columns(block, column_tables, false);
+					if (filter) {
+						dmimg::parallel_for(0, height, [&](int y_begin, int y_end) {
+							for (int y = y_begin; y < y_end; y++) {
+								filter->apply(block.row(y), x0, y, columns);
+							}
+						});
+					}
+					dmimg::fft_columns(block, column_tables, true);
+					for (int y0 = 0; y0 < height; y0 += out_of_core_release_rows) {
+						const int rows = std::min(out_of_core_release_rows, height - y0);
+						dmimg::parallel_for(y0, y0 + rows, [&](int y_begin, int y_end) {
+							for (int y = y_begin; y < y_end; y++) {
+								std::copy(block.row(y), block.row(y) + columns, spectrum + size_t(y) * half_width + x0);
+							}
+						});
+						scratch.release((c * channel_size + size_t(y0) * half_width) * sizeof(complex<Real>), size_t(rows) * half_width * sizeof(complex<Real>));
 					}
 				}
 			}
-		}
-		// now, remove the low-frequencies
-		for (int y = 0; y < height; y++) {
-			for (int x = 0; x < width; x++) {
-				// distance to point
-				int distance = std::sqrt((x - half_width) * (x - half_width) + (y - half_height) * (y - half_height));
-				if (distance < radius) {
-					(*mask)[y][x] = zero;
+
+			// rows, inverse
+			Band_writer writer(output_path, width, height);
+			const Real sizes_multiplied = Real(double(width) * height);
+			for (int y0 = 0; y0 < height; y0 += band_height) {
+				const int rows = std::min(band_height, height - y0);
+				for (int c = 0; c < channels; c++) {
+					dmimg::parallel_for(0, rows, [&](int y_begin, int y_end) {
+						for (int y = y_begin; y < y_end; y++) {
+							complex<Real>* row = spectra + c * channel_size + size_t(y0 + y) * half_width;
+							dmimg::fft_inverse_real_row(row, half_row_tables, full_row_tables);
+							const Real* samples = reinterpret_cast<const Real*>(row);
+							for (int x = 0; x < width; x++) {
+								int value = int(std::abs(samples[x] / sizes_multiplied) + 0.5);
+								if (channels == 1) dmimg::set_rgb_safe(band, x, y, value);
+								else band(x, y, 0, c) = dmimg::check_value(value);
+							}
+						}
+					});
+					scratch.release((c * channel_size + size_t(y0) * half_width) * sizeof(complex<Real>), size_t(rows) * half_width * sizeof(complex<Real>));
 				}
+				writer.write_rows(y0, band, rows);
 			}
+			writer.finish();
 		}
-		// done
-		return mask;
 	}
 
-	void high_pass_filter_edge_detection(vector<vector<complex<double>>>& input, int angle, int detection_width, int radius, int zeroAtXaxxis) {
-		if (!(zeroAtXaxxis == 0 or zeroAtXaxxis == 1)) dmimg::error("invalid parameter: zeroAtXaxxis can be 0 or 1");
-		bool zeroAtXaxxisBool = (zeroAtXaxxis == 1) ? true : false;
-		shared_ptr<vector<vector<complex<double>>>> mask = high_pass_edge_detection_filter_mask(input[0].size(), input.size(), angle, detection_width, radius, zeroAtXaxxisBool);
-		for (int y = 0; y < input.size(); y++) {
-			for (int x = 0; x < input[0].size(); x++) {
-				input[y][x] = input[y][x] * (*mask)[y][x];
-			}
+	// fft filter of an image file larger than the memory in fft_precision_mode and fft_color_mode
+	void fft_filter_out_of_core(const std::string& source_path, const std::string& output_path, const Frequency_filter* filter) {
+		const int channels = fft_color_mode ? 3 : 1;
+		if (fft_precision_mode == Fft_precision::single_precision) {
+			dmimg::fft_filter_out_of_core_as<float>(source_path, output_path, filter, channels);
+		}
+		else {
+			dmimg::fft_filter_out_of_core_as<double>(source_path, output_path, filter, channels);
 		}
 	}
 
-	shared_ptr<vector<vector<complex<double>>>> phase_modifying_filter_mask(int width, int height, int l, int k) {
-		auto mask = std::make_shared<vector<vector<complex<double>>>>();
-		using namespace std::complex_literals;
 
-		for (int y = 0; y < height; y++) {
-			vector<complex<double>> temp_row;
-			for (int x = 0; x < width; x++) {
-				complex<double> p, inside;
-				inside = ((-1.0 * x) * double(k) * 2.0 * value_pi_double) / width +
-					((-1.0 * y) * double(l) * 2.0 * value_pi_double) / height +
-					double(k + l) * value_pi_double;
-				inside *= 1i;
-				p = exp(inside);
-				temp_row.push_back(p);
+	// template matching
+	// normalized cross-correlation of a template with every position of the image where it fits whole:
+	// ncc(x, y) = sum (I(x + i, y + j) - mean I) * (T(i, j) - mean T) / sqrt(sum (I - mean I)^2 * sum (T - mean T)^2)
+	// the numerator is sum I(x + i, y + j) * (T(i, j) - mean T), the correlation of the image with the template
+	// without its mean, computed by the fft: the spectrum of the image times the conjugated spectrum of the
+	// template padded to the image size (where the template fits, the correlation never wraps around)
+	// the local energies sum (I - mean I)^2 = sum I^2 - (sum I)^2 / n come from sums of I and I^2 over the
+	// template window: the sums of the columns of the template height are moved down by a row (one row added,
+	// one taken away) and their prefix sums along the row, a one row integral image, give every window
+	// in 2 lookups, so a position costs the same for any template size and no image sized tables are kept
+	// the images are gray, the sum of the channels (ncc doesn't change with the scale of the values)
+
+	// position of the top left corner of the template in the image
+	struct Template_match {
+		int x = 0;
+		int y = 0;
+		double score = 0;
+	};
+
+	// ncc of all the positions of the template: (image width - template width + 1) x (image height - template height + 1)
+	struct Correlation_map {
+		int width = 0;
+		int height = 0;
+		vector<float> scores;
+
+		float operator()(int x, int y) const { return scores[size_t(y) * width + x]; }
+	};
+
+	// sum of the channels of the image, the width rounded up to even (as the real input fft needs) with a 0 column
+	template <class T>
+	CImg<float> matching_image(const CImg<T>& img) {
+		CImg<float> output(img.width() + img.width() % 2, img.height(), 1, 1);
+		dmimg::parallel_for(0, img.height(), [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				float* row = output.data(0, y, 0, 0);
+				std::fill(row, row + output.width(), 0.0f);
+				for (int c = 0; c < img.spectrum(); c++) {
+					const T* pixels = img.data(0, y, 0, c);
+					for (int x = 0; x < img.width(); x++) row[x] += float(pixels[x]);
+				}
 			}
-			mask->push_back(temp_row);
-		}
-		// done
-		return mask;
+		});
+		return output;
 	}
 
-	void phase_modifying_filter(vector<vector<complex<double>>>& input, int l, int k) {
-		shared_ptr<vector<vector<complex<double>>>> mask = phase_modifying_filter_mask(input[0].size(), input.size(), l, k);
-		for (int y = 0; y < input.size(); y++) {
-			for (int x = 0; x < input[0].size(); x++) {
-				// we are interested only in imaginary part as real part of the mask should be 1
-				input[y][x] = input[y][x] * (*mask)[y][x];
+	// the template without its mean and its conjugated spectrum for every image size it has been matched with,
+	// so a sequence of images (of one size) costs a forward and an inverse fft each
+	// the fft is done in fft_precision_mode, the spectra of the template are kept in double
+	class Template_matcher {
+	public:
+		template <class T>
+		explicit Template_matcher(const CImg<T>& template_img) {
+			CImg<float> gray = dmimg::matching_image(template_img);
+			width_ = template_img.width();
+			height_ = template_img.height();
+			values_.resize(size_t(width_) * height_);
+			double sum = 0;
+			for (int y = 0; y < height_; y++) {
+				for (int x = 0; x < width_; x++) sum += gray(x, y);
 			}
+			const double mean = sum / values_.size();
+			energy_ = 0;
+			for (int y = 0; y < height_; y++) {
+				for (int x = 0; x < width_; x++) {
+					values_[size_t(y) * width_ + x] = gray(x, y) - mean;
+					energy_ += values_[size_t(y) * width_ + x] * values_[size_t(y) * width_ + x];
+				}
+			}
+			if (energy_ <= 1e-9 * values_.size()) dmimg::error("the template is flat, it can't be matched");
 		}
-	}
-	
-	// commented out to fit in shr_ptr not raw ptr
-	void lowpass_filter(vector<vector<complex<double>>>& original, int threshold) {
-		//auto* edited = new vector<vector<complex<double>>>;
-		//for (const auto& i : original) (*edited).push_back(i);
 
-		for (int x = 1; x < original.size(); x++) {
-			for (int y = 1; y < original[1].size(); y++) {
-				double d = sqrt(pow(x - original.size() / 2.0, 2.0) + pow(y - original[1].size() / 2.0, 2.0));
-				if (d > threshold) {
-					//edited->at(y).at(x) = (0.0, 0.0);
-					original[y][x] = (0.0, 0.0);
+		int width() const { return width_; }
+		int height() const { return height_; }
+
+		template <class T>
+		Correlation_map match(const CImg<T>& img) {
+			if (fft_precision_mode == Fft_precision::single_precision) return match_as<float>(img);
+			return match_as<double>(img);
+		}
+
+	private:
+		template <class Real, class T>
+		Correlation_map match_as(const CImg<T>& img) {
+			if (img.width() < width_ or img.height() < height_) dmimg::error("the template is larger than the image");
+			CImg<float> gray = dmimg::matching_image(img);
+			const Spectrum_filter filter(template_spectrum(gray.width(), gray.height()));
+			Basic_complex_matrix<Real> correlation = dmimg::get_fft_plan<Real>(gray.width(), gray.height(), Fft_direction::forward).execute(gray);
+			dmimg::get_fft_plan<Real>(gray.width(), gray.height(), Fft_direction::inverse).execute(correlation, &filter);
+
+			Correlation_map map;
+			map.width = img.width() - width_ + 1;
+			map.height = img.height() - height_ + 1;
+			map.scores.resize(size_t(map.width) * map.height);
+			const double count = double(width_) * height_;
+			dmimg::parallel_for(0, map.height, [&](int y_begin, int y_end) {
+				// the sums of 8-bit images are integers, so adding and taking away rows is exact
+				vector<double> column_sums(img.width(), 0.0);
+				vector<double> column_squares(img.width(), 0.0);
+				vector<double> sums(img.width() + 1, 0.0);
+				vector<double> squares(img.width() + 1, 0.0);
+				auto add_row = [&](int y, double sign) {
+					const float* row = gray.data(0, y, 0, 0);
+					for (int x = 0; x < img.width(); x++) {
+						column_sums[x] += sign * row[x];
+						column_squares[x] += sign * double(row[x]) * row[x];
+					}
+				};
+				for (int j = 0; j < height_ - 1; j++) add_row(y_begin + j, 1.0);
+				for (int y = y_begin; y < y_end; y++) {
+					add_row(y + height_ - 1, 1.0);
+					for (int x = 0; x < img.width(); x++) {
+						sums[x + 1] = sums[x] + column_sums[x];
+						squares[x + 1] = squares[x] + column_squares[x];
+					}
+					add_row(y, -1.0);
+					const Real* products = reinterpret_cast<const Real*>(correlation.row(y));
+					for (int x = 0; x < map.width; x++) {
+						const double sum = sums[x + width_] - sums[x];
+						const double local_energy = squares[x + width_] - squares[x] - sum * sum / count;
+						// flat parts of the image (less than 0.01 of a gray level of deviation) match nothing
+						const double score = (local_energy > 1e-4 * count) ? products[x] / std::sqrt(local_energy * energy_) : 0.0;
+						map.scores[size_t(y) * map.width + x] = float(std::min(std::max(score, -1.0), 1.0));
+					}
 				}
+			});
+			return map;
+		}
+
+		// conj of the spectrum of the template at (0, 0) of a width x height image
+		const Complex_matrix& template_spectrum(int width, int height) {
+			auto found = spectra_.find({ width, height });
+			if (found != spectra_.end()) return found->second;
+			CImg<double> padded(width, height, 1, 1, 0);
+			for (int y = 0; y < height_; y++) {
+				for (int x = 0; x < width_; x++) padded(x, y) = values_[size_t(y) * width_ + x];
 			}
+			Complex_matrix spectrum = dmimg::get_fft_plan<double>(width, height, Fft_direction::forward).execute(padded);
+			for (size_t i = 0; i < spectrum.size(); i++) spectrum.data()[i] = std::conj(spectrum.data()[i]);
+			return spectra_.emplace(std::make_pair(width, height), std::move(spectrum)).first->second;
 		}
-	//	original = *edited;
-	}
 
-	// commented out to fit in shr_ptr not raw ptr
-	void bandpass_filter(vector<vector<complex<double>>>& original, int threshold, int width) {
-		//auto* edited = new vector<vector<complex<double>>>;
-		//for (const auto& i : original) (*edited).push_back(i);
+		int width_ = 0;
+		int height_ = 0;
+		vector<double> values_;
+		double energy_ = 0;
+		std::map<std::pair<int, int>, Complex_matrix> spectra_;
+	};
 
-		for (int x = 0; x < original.size(); x++) {
-			for (int y = 0; y < original[0].size(); y++) {
-				double d = sqrt(pow(x - original.size() / 2.0, 2.0) + pow(y - original[0].size() / 2.0, 2.0));
-				if ((threshold - width / 2.0 > d) || (threshold + width / 2.0 < d)) {
-					//edited->at(y).at(x) = (0.0, 0.0);
-					original[y][x] = (0.0, 0.0);
+	// the count best matches: local maxima of the map, the best first, a match is left out if it is
+	// closer than half of the template size (in both directions) to a better one
+	// the maxima are a heap, only as many of them are taken out as needed
+	vector<Template_match> top_matches(const Correlation_map& map, int count, int template_width, int template_height) {
+		vector<vector<Template_match>> row_candidates(map.height);
+		dmimg::parallel_for(0, map.height, [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				for (int x = 0; x < map.width; x++) {
+					const float score = map(x, y);
+					// most positions have a larger neighbour in the row
+					if ((x > 0 and map(x - 1, y) > score) or (x + 1 < map.width and map(x + 1, y) > score)) continue;
+					bool maximum = true;
+					for (int j = std::max(y - 1, 0); j <= std::min(y + 1, map.height - 1) and maximum; j++) {
+						if (j == y) continue;
+						for (int i = std::max(x - 1, 0); i <= std::min(x + 1, map.width - 1); i++) {
+							if (map(i, j) > score) {
+								maximum = false;
+								break;
+							}
+						}
+					}
+					if (maximum) row_candidates[y].push_back({ x, y, score });
 				}
 			}
+		});
+		vector<Template_match> candidates;
+		for (const vector<Template_match>& row : row_candidates) candidates.insert(candidates.end(), row.begin(), row.end());
+		auto worse = [](const Template_match& a, const Template_match& b) { return a.score < b.score; };
+		std::make_heap(candidates.begin(), candidates.end(), worse);
+		const int distance_x = std::max(template_width / 2, 1);
+		const int distance_y = std::max(template_height / 2, 1);
+		vector<Template_match> matches;
+		while (int(matches.size()) < count and !candidates.empty()) {
+			std::pop_heap(candidates.begin(), candidates.end(), worse);
+			const Template_match candidate = candidates.back();
+			candidates.pop_back();
+			bool separate = true;
+			for (const Template_match& match : matches) {
+				if (std::abs(match.x - candidate.x) < distance_x and std::abs(match.y - candidate.y) < distance_y) separate = false;
+			}
+			if (separate) matches.push_back(candidate);
+		}
+		return matches;
+	}
+
+	// the map as a gray image, ncc -1 is black and 1 is white
+	CImg<unsigned char> correlation_map_image(const Correlation_map& map) {
+		CImg<unsigned char> output(map.width, map.height, 1, 3);
+		for (int y = 0; y < map.height; y++) {
+			for (int x = 0; x < map.width; x++) {
+				dmimg::set_rgb_safe(output, x, y, int((map(x, y) + 1.0f) * 127.5f + 0.5f));
+			}
 		}
-		//original = *edited;
+		return output;
 	}
 
-	void bandcut_filter(vector<vector<complex<double>>>& original, int threshold, int width) {
-		//auto* edited = new vector<vector<complex<double>>>;
-		//for (const auto& i : original) (*edited).push_back(i);
 
-		for (int x = 0; x < original.size(); x++) {
-			for (int y = 0; y < original[0].size(); y++) {
-				double d = sqrt(pow(x - original.size() / 2.0, 2.0) + pow(y - original[0].size() / 2.0, 2.0));
-				if ((threshold - width / 2.0 <= d) && (threshold + width / 2.0 >= d)) {
-					//edited->at(y).at(x) = (0.0, 0.0);
-					original[y][x] = (0.0, 0.0);
-				}
+	// batch processing
+	// the images of a directory (or of a list file) go through three stages: decoding, the operation and
+	// encoding, connected by queues of at most batch_queue_size images, so the memory stays bounded for
+	// any number of images and one process serves them all
+	// the workers are the tasks of the thread pool (-j), each one takes a job of the latest stage which has
+	// one (encoding, then the operation, then decoding: the images in flight are finished first), and
+	// parallel_for inside a task runs on its thread, so an image is processed by one thread
+
+	// images waiting between two stages (per worker of the thread pool)
+	const int batch_queue_size = 2;
+
+	// input and output paths of the batch: the files of the input directory (sorted by name)
+	// or the lines of the input list file, written to the output directory under the same names
+	vector<std::pair<std::string, std::string>> batch_files(const std::string& input, const std::string& output_directory) {
+		namespace fs = std::filesystem;
+		vector<std::string> inputs;
+		if (fs::is_directory(input)) {
+			for (const fs::directory_entry& entry : fs::directory_iterator(input)) {
+				if (entry.is_regular_file()) inputs.push_back(entry.path().string());
+			}
+			std::sort(inputs.begin(), inputs.end());
+		}
+		else {
+			std::ifstream list(input);
+			if (!list) dmimg::error("Can't read the batch input " + input);
+			std::string line;
+			while (std::getline(list, line)) {
+				if (!line.empty() and line.back() == '\r') line.pop_back();
+				if (!line.empty()) inputs.push_back(line);
 			}
 		}
-		//original = *edited;
-		
+		fs::create_directories(output_directory);
+		vector<std::pair<std::string, std::string>> files;
+		for (const std::string& path : inputs) {
+			files.emplace_back(path, (fs::path(output_directory) / fs::path(path).filename()).string());
+		}
+		return files;
 	}
 
+	struct Batch_report {
+		size_t images = 0;
+		size_t failed = 0;
+		// the operation gave no image (it only prints something)
+		size_t without_output = 0;
+		int workers = 0;
+		double seconds = 0;
+		// time of the stages, summed over the workers
+		double decoding_seconds = 0;
+		double operation_seconds = 0;
+		double encoding_seconds = 0;
+	};
+
+	// runs operation(image, result) for every file, it returns false if it has no result
+	// an image which fails (decoding, the operation or encoding) is reported on std::cerr and the batch goes on
+	Batch_report run_batch(const vector<std::pair<std::string, std::string>>& files, const std::function<bool(CImg<unsigned char>&, CImg<unsigned char>&)>& operation) {
+		using clock = std::chrono::high_resolution_clock;
+		auto seconds_since = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+		struct Item {
+			size_t index;
+			CImg<unsigned char> image;
+		};
+		Thread_pool& pool = dmimg::thread_pool();
+		const size_t queue_size = size_t(batch_queue_size) * pool.size();
+		// guarded by mutex, a slot of a queue is taken when a job starts, so a queue never has more than queue_size images
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::deque<Item> decoded;
+		std::deque<Item> results;
+		size_t next = 0;
+		size_t decoding = 0;
+		size_t computing = 0;
+		size_t finished = 0;
+		Batch_report report;
+		report.images = files.size();
+		report.workers = pool.size();
+		auto fail = [&](size_t index, const std::string& message) {
+			report.failed++;
+			std::cerr << files[index].first << ": " << message << std::endl;
+		};
+		// the job of a stage: the exception message, empty if it went well
+		auto attempt = [](const std::function<void()>& job) -> std::string {
+			try {
+				job();
+				return "";
+			}
+			catch (const std::exception& e) {
+				return e.what()[0] ? e.what() : "error";
+			}
+			catch (...) {
+				return "error";
+			}
+		};
+
+		const clock::time_point batch_start = clock::now();
+		pool.run(pool.size(), [&](int) {
+			std::unique_lock<std::mutex> lock(mutex);
+			while (finished < files.size()) {
+				if (!results.empty()) {
+					Item item = std::move(results.front());
+					results.pop_front();
+					lock.unlock();
+					const clock::time_point start = clock::now();
+					std::string error = attempt([&]() { item.image.save(files[item.index].second.c_str()); });
+					lock.lock();
+					report.encoding_seconds += seconds_since(start);
+					if (!error.empty()) fail(item.index, error);
+					finished++;
+				}
+				else if (!decoded.empty() and results.size() + computing < queue_size) {
+					Item item = std::move(decoded.front());
+					decoded.pop_front();
+					computing++;
+					lock.unlock();
+					const clock::time_point start = clock::now();
+					Item result{ item.index, CImg<unsigned char>() };
+					bool has_result = false;
+					std::string error = attempt([&]() { has_result = operation(item.image, result.image); });
+					lock.lock();
+					report.operation_seconds += seconds_since(start);
+					computing--;
+					if (!error.empty()) fail(item.index, error);
+					else if (has_result) results.push_back(std::move(result));
+					else report.without_output++;
+					if (!error.empty() or !has_result) finished++;
+				}
+				else if (next < files.size() and decoded.size() + decoding < queue_size) {
+					Item item{ next++, CImg<unsigned char>() };
+					decoding++;
+					lock.unlock();
+					const clock::time_point start = clock::now();
+					std::string error = attempt([&]() { item.image = CImg<unsigned char>(files[item.index].first.c_str()); });
+					lock.lock();
+					report.decoding_seconds += seconds_since(start);
+					decoding--;
+					if (!error.empty()) {
+						fail(item.index, error);
+						finished++;
+					}
+					else decoded.push_back(std::move(item));
+				}
+				else {
+					changed.wait(lock);
+					continue;
+				}
+				// a queue has a new image or a free slot
+				changed.notify_all();
+			}
+			changed.notify_all();
+		});
+		report.seconds = seconds_since(batch_start);
+		return report;
+	}
 
 } // end of dmimg namespace
 
+#ifdef DMIMG_COUNT_ALLOCATIONS
+// every call of operator new is counted, used by --fft_benchmark
+// (a build option, so that the allocations of the other operations don't pay for the counter)
+std::atomic<long long> allocations_count(0);
+
+// not inlined, otherwise g++ sees malloc paired with delete expressions (-Wmismatched-new-delete)
+[[gnu::noinline]] void* operator new(std::size_t size) {
+	allocations_count++;
+	if (void* pointer = std::malloc(size == 0 ? 1 : size)) return pointer;
+	throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void* pointer) noexcept {
+	std::free(pointer);
+}
+[[gnu::noinline]] void operator delete(void* pointer, std::size_t) noexcept {
+	std::free(pointer);
+}
+
+long long allocations_made() {
+	return allocations_count;
+}
+#else
+// allocations are not counted in this build
+long long allocations_made() {
+	return -1;
+}
+#endif
+
+// "n allocations, " for the benchmarks, nothing when they are not counted
+std::string allocations_since(long long allocations_before) {
+	if (allocations_before < 0) return "";
+	return std::to_string(allocations_made() - allocations_before) + " allocations, ";
+}
+
 int main(int argc, char** argv) {
 	// program invocation can look like this
 	// dmimg.exe images/24bit_color/lenac.bmp lenac_output.bmp --brightness 25
@@ -1613,6 +5966,96 @@ int main(int argc, char** argv) {
 	std::string output_file = "";
 	app.add_option("filename, -o, --output", output_file, "Path to second image (usually output image)");
 
+	std::string marker_file = "";
+	app.add_option("-m, --marker", marker_file, "Path to marker image (used by reconstruction)");
+
+	// parallel operations (fft, distance transform, segmentation...) run on a pool of threads
+	app.add_option_function<int>("-j, --threads", [](const int& threads_count) { dmimg::set_threads_count(threads_count); }, "Number of threads of parallel operations (default: one per hardware thread)");
+
+	// fft planning, the measured choices can be kept in a file for the next runs
+	std::string fft_wisdom_file = "";
+	app.add_option_function<std::string>("--fft_wisdom", [&](const std::string& path) {
+		fft_wisdom_file = path;
+		dmimg::load_fft_wisdom(path);
+		}, "Fft wisdom file, loaded at start and saved at the end");
+	app.add_option_function<std::string>("--fft_planning", [](const std::string& mode) {
+		if (mode == "estimate") dmimg::fft_planning_mode = dmimg::Fft_planning::estimate;
+		else if (mode == "measure") dmimg::fft_planning_mode = dmimg::Fft_planning::measure;
+		else dmimg::error("fft planning can be estimate or measure");
+		}, "How fft plans choose the algorithms: estimate (default) or measure");
+	app.add_option_function<std::string>("--fft_precision", [](const std::string& precision) {
+		if (precision == "double") dmimg::fft_precision_mode = dmimg::Fft_precision::double_precision;
+		else if (precision == "single") dmimg::fft_precision_mode = dmimg::Fft_precision::single_precision;
+		else dmimg::error("fft precision can be double or single");
+		}, "Numbers in the fft of --fft, --ffti and the fft filters: double (default) or single (float)");
+	app.add_flag("--fft_color", dmimg::fft_color_mode, "--fft, --ffti and the fft filters transform all 3 channels (by default only the red one, the result is gray)");
+	app.add_option_function<std::string>("--spectrum_view", [](const std::string& view) {
+		if (view == "magnitude") dmimg::spectrum_view_mode = dmimg::Spectrum_view::magnitude;
+		else if (view == "phase") dmimg::spectrum_view_mode = dmimg::Spectrum_view::phase;
+		else dmimg::error("spectrum view can be magnitude or phase");
+		}, "What --fft shows: magnitude (default) or phase");
+	app.add_option_function<std::string>("--spectrum_scale", [](const std::string& scale) {
+		if (scale == "fixed") dmimg::spectrum_scale_mode = dmimg::Spectrum_scale::fixed;
+		else if (scale == "auto") dmimg::spectrum_scale_mode = dmimg::Spectrum_scale::automatic;
+		else dmimg::error("spectrum scale can be fixed or auto");
+		}, "Gray levels of the magnitudes of --fft: fixed (default, 15 * ln|X|, clamped) or auto (log scale up to the largest magnitude)");
+	app.add_option("--spectrum_cache", dmimg::spectrum_cache_directory, "Directory of the spectrum cache: the fft filters keep the spectrum of the image there (a file named after the hash of the image) and the next runs on the same image map it instead of computing the forward fft");
+	app.add_option_function<int>("--mem-limit, --mem_limit", [](const int& megabytes) {
+		if (megabytes <= 0) dmimg::error("memory limit must be positive");
+		dmimg::memory_limit = size_t(megabytes) << 20;
+		}, "Memory of the out-of-core operations in MB (default: 1024)");
+	app.add_option_function<std::string>("--convolution_method", [](const std::string& method) {
+		if (method == "auto") dmimg::convolution_method = dmimg::Convolution_method::automatic;
+		else if (method == "direct") dmimg::convolution_method = dmimg::Convolution_method::direct;
+		else if (method == "separable") dmimg::convolution_method = dmimg::Convolution_method::separable;
+		else if (method == "fft") dmimg::convolution_method = dmimg::Convolution_method::fft;
+		else dmimg::error("convolution method can be auto, direct, separable or fft");
+		}, "Method of --convolve: auto (default, the cheapest one for the kernel and the image size), direct, separable or fft (overlap-save)");
+	app.add_option_function<int>("--register_scale", [](const int& scale) {
+		if (scale < 0) dmimg::error("registration scale can't be negative");
+		dmimg::registration_scale = scale;
+		}, "Block size averaged before --register: 1 is full resolution, 0 (default) reduces the images to at most 1024 pixels on the longer side");
+	int match_count = 5;
+	app.add_option("--match_count", match_count, "Number of the best matches --match_template prints for every image (default: 5)");
+	std::vector<std::string> match_images;
+	app.add_option("--match_images", match_images, "More images searched by --match_template after the source image, with the same template spectrum");
+
+
+	// batch mode: the operation is run for every image of a directory or a list file,
+	// it is kept (operation) instead of being run at once, load_source and save_output give it
+	// the image decoded by the batch and take its result instead of reading and writing the files
+	// operations which compare or read other files, write other files or only print are not batchable,
+	// the batch is refused before it starts
+	std::vector<std::string> batch_paths;
+	app.add_option("--batch", batch_paths, "Input directory (or a file with one image path per line) and output directory: the operation is done on every image, the results have the same names. Decoding, the operation and encoding run on the thread pool (-j) as a pipeline, the throughput and the use of the threads by each stage are printed at the end")->expected(2);
+	std::function<void()> batch_operation;
+	bool batchable = true;
+	thread_local CImg<unsigned char>* batch_input = nullptr;
+	thread_local CImg<unsigned char>* batch_result = nullptr;
+	auto operation = [&](std::function<void()> body, bool can_batch = true) {
+		return [&, body, can_batch]() {
+			if (batch_paths.empty()) body();
+			else {
+				batch_operation = body;
+				batchable = can_batch;
+			}
+		};
+	};
+	auto load_source = [&]() -> CImg<unsigned char> {
+		if (batch_input) return std::move(*batch_input);
+		return CImg<unsigned char>(source_file.c_str());
+	};
+	auto save_output = [&](CImg<unsigned char>& img) {
+		if (batch_result) *batch_result = std::move(img);
+		else img.save(output_file.c_str());
+	};
+	// messages of the operations (times etc.), left out in batch mode
+	// (every thread has its own muted stream, its error state isn't shared)
+	thread_local std::ostream muted_messages(nullptr);
+	auto messages = [&]() -> std::ostream& {
+		return batch_paths.empty() ? std::cout : muted_messages;
+	};
+
 
 	// groups of operations --brightness --contrast etc. but only one can be applied
 	auto operations = app.add_option_group("Operations", "The program allows for several image manipulations techniques.");
@@ -1626,119 +6069,119 @@ int main(int argc, char** argv) {
 		// Task 1 - B
 	auto brightness = operations->add_option_group("brightness", "Brightness modification");
 	brightness->add_option("--brightness", argument, "Alter the brightness by a given argument");
-	brightness->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	brightness->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::brightness(img, argument[0]);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto contrast = operations->add_option_group("contrast", "Contrast modification");
 	contrast->add_option("--contrast", argument, "Alter the contrast by a given amount");
-	contrast->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	contrast->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::contrast(img, argument[0]);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto negative = operations->add_option_group("negative", "Inverse the image");
 	negative->add_flag("--negative", "Output image will be inversed");
-	negative->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	negative->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::negative(img);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// Task 1 - G 
 	auto hflip = operations->add_option_group("horizontal flip", "Horizontal flip of the image");
 	hflip->add_flag("--hflip", "Flip the img horizontally");
-	hflip->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	hflip->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::hflip(img);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto vflip = operations->add_option_group("vertical flip", "Vertical flip of the image");
 	vflip->add_flag("--vflip", "Flip the img vertically");
-	vflip->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	vflip->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::vflip(img);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto dflip = operations->add_option_group("diagonal flip", "Diagonal flip of the image");
 	dflip->add_flag("--dflip", "Diagonal flip of the image");
-	dflip->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	dflip->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::dflip(img);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto shrink = operations->add_option_group("shrink", "Shrinks the image x2");
 	shrink->add_flag("--shrink", "Shrink the image x2");
-	shrink->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	shrink->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::shrink(img);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto enlarge = operations->add_option_group("enlarge", "Scales the image x2");
 	enlarge->add_flag("--enlarge", "Scale the img x2");
-	enlarge->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	enlarge->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::enlarge(img);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// Task 1 - N4
 	auto mid = operations->add_option_group("midpoint filter", "Applies midpoint filter");
 	mid->add_flag("--mid", "Apply midpoint filter to an image");
-	mid->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	mid->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::mid(img);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto amean = operations->add_option_group("arithmetic mean filter", "Applies arithmetic mean filter");
 	amean->add_flag("--amean", "Apply arithmetic mean filter to an image");
-	amean->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	amean->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::amean(img);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// Task 1 - E
 	auto mse = operations->add_option_group("mean squared error", "Computes mean squared error of img1 & img2");
 	mse->add_flag("--mse", "Compute mean squared error (mse) of img1 & img2");
-	mse->callback([&]() {
+	mse->callback(operation([&]() {
 		CImg<unsigned char> img1(source_file.c_str());
 		CImg<unsigned char> img2(output_file.c_str());
-		std::cout << "mse: " << dmimg::mse(img1, img2) << std::endl;
-		});
+		messages() << "mse: " << dmimg::mse(img1, img2) << std::endl;
+		}, false));
 	auto pmse = operations->add_option_group("peak mean squared error", "Computes peak mean squared error of img1 & img2");
 	pmse->add_flag("--pmse", "Compute peak mean squared error (pmse) of img1 & img2");
-	pmse->callback([&]() {
+	pmse->callback(operation([&]() {
 		CImg<unsigned char> img1(source_file.c_str());
 		CImg<unsigned char> img2(output_file.c_str());
-		std::cout << "pmse: " << dmimg::pmse(img1, img2) << std::endl;
-		});
+		messages() << "pmse: " << dmimg::pmse(img1, img2) << std::endl;
+		}, false));
 	auto snr = operations->add_option_group("signal to noise ratio", "Computes signal to noise ratio of img1 & img2");
 	snr->add_flag("--snr", "Compute signal to noise ratio (snr) of img1 & img2 where img1 is P_signal and img2 is P_noise");
-	snr->callback([&]() {
+	snr->callback(operation([&]() {
 		CImg<unsigned char> img1(source_file.c_str());
 		CImg<unsigned char> img2(output_file.c_str());
-		std::cout << "snr: " << dmimg::snr(img1, img2) << std::endl;
-		});
+		messages() << "snr: " << dmimg::snr(img1, img2) << std::endl;
+		}, false));
 	auto psnr = operations->add_option_group("peak signal to noise ratio", "Computes peak signal to noise ratio of img1 & img2");
 	psnr->add_flag("--psnr", "Compute peak signal to noise ratio (psnr) of img1 & img2");
-	psnr->callback([&]() {
+	psnr->callback(operation([&]() {
 		CImg<unsigned char> img1(source_file.c_str());
 		CImg<unsigned char> img2(output_file.c_str());
-		std::cout << "psnr: " << dmimg::psnr(img1, img2) << std::endl;
-		});
+		messages() << "psnr: " << dmimg::psnr(img1, img2) << std::endl;
+		}, false));
 	auto md = operations->add_option_group("maximum difference", "Computes  maximum difference of img1 & img2");
 	md->add_flag("--md", "Compute maximum difference (md) of img1 & img2");
-	md->callback([&]() {
+	md->callback(operation([&]() {
 		CImg<unsigned char> img1(source_file.c_str());
 		CImg<unsigned char> img2(output_file.c_str());
 		dmimg::md(img1, img2);
-		});
+		}, false));
 	// ######################################################################
 	// Task 2
 	int slowpass_argument = 1;
 	auto slowpass = operations->add_option_group("Low-pass filter", "Creates low pass filter image");
 	slowpass->add_option("--slowpass", slowpass_argument, "Applies low-pass filter to an image. There are 3 variants chosen with the argument (from 1 to 3)");
-	slowpass->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	slowpass->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		int mask[3][3];
 		int mask_1[3][3] = {
 			{1, 1, 1} ,   /*  initializers for row indexed by 0 */
@@ -1785,14 +6228,14 @@ int main(int argc, char** argv) {
 		// stop the timer
 		auto stop = std::chrono::high_resolution_clock::now();
 		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-		std::cout << "Low-pass filter applied in: " << duration.count() << " microseconds." << std::endl;
+		messages() << "Low-pass filter applied in: " << duration.count() << " microseconds." << std::endl;
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto slowpass_optimized = operations->add_option_group("Low-pass filter optimized", "Creates low pass filter image with variant 2");
 	slowpass_optimized->add_flag("--slowpass_optimized", "Applies optimized low-pass filter to an image - variant 2");
-	slowpass_optimized->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	slowpass_optimized->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		// start measuring time
 		auto start = std::chrono::high_resolution_clock::now();
 
@@ -1801,70 +6244,70 @@ int main(int argc, char** argv) {
 		// stop the timer
 		auto stop = std::chrono::high_resolution_clock::now();
 		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-		std::cout << "Optimized low-pass filter applied in: " << duration.count() << " microseconds." << std::endl;
+		messages() << "Optimized low-pass filter applied in: " << duration.count() << " microseconds." << std::endl;
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// Rosenfeld operator
 	auto orosenfeld = operations->add_option_group("orosenfeld", "Rosenfeld operator");
 	orosenfeld->add_option("--orosenfeld", argument, "Apply Rosenfeld operator with an p argument which can take following values p = 1, 2, 4, 8, 16, ...");
-	orosenfeld->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	orosenfeld->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::orosenfeld(img, argument[0]);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// Histogram
 	auto histogram = operations->add_option_group("histogram", "Histogram");
 	histogram->add_option("--histogram", argument, "Generate Histogram");
-	histogram->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	histogram->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::histogram(img, argument[0]);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// Power 2/3 final probability density function
 	auto hpower = operations->add_option_group("hpower", "Power 2/3 final probability density function");
 	hpower->add_option("--hpower", argument, "Computes power 2/3 final probability density function");
-	hpower->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	hpower->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::hpower(img, argument[0], argument[1]);
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// Variation coefficient II
 	auto cvarcoii = operations->add_option_group("cvarcoii", "Variation coefficient II");
 	cvarcoii->add_flag("--cvarcoii", "Computes variation coefficient II of image");
-	cvarcoii->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	cvarcoii->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 		dmimg::cvarcoii(img);
-		});
+		}, false));
 	// ######################################################################
 	// Task 3
 
 	// erosion
 	auto erosion = operations->add_option_group("erosion", "erosion operation");
 	erosion->add_option("--erosion", argument, "Apply erosion of the image with specific structural element");
-	erosion->callback([&]() {
+	erosion->callback(operation([&]() {
 		using namespace dmimg;
-		CImg<unsigned char> img(source_file.c_str());
+		CImg<unsigned char> img = load_source();
 		if (1 > argument[0] or argument[0] > 10) dmimg::error("Wrong argument! This operation can take structural element from 1 to 10");
 		dmimg::erosion(img, dmimg::get_structural_element(argument[0]));
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// dilation
 	auto dilation = operations->add_option_group("dilation", "dilation operation");
 	dilation->add_option("--dilation", argument, "Apply dilation of the image with specific structural element");
-	dilation->callback([&]() {
+	dilation->callback(operation([&]() {
 		using namespace dmimg;
-		CImg<unsigned char> img(source_file.c_str());
+		CImg<unsigned char> img = load_source();
 		if (1 > argument[0] or argument[0] > 10) dmimg::error("Wrong argument! This operation can take structural element from 1 to 10");
 		dmimg::dilation(img, dmimg::get_structural_element(argument[0]));
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// slow version of opening - first dilation then erosion
 	auto opening_slow = operations->add_option_group("opening", "opening operation - slow version");
 	opening_slow->add_option("--opening_slow", argument[0], "Apply slow version of the opening of the image with specific structural element");
-	opening_slow->callback([&]() {
+	opening_slow->callback(operation([&]() {
 		using namespace dmimg;
-		CImg<unsigned char> img(source_file.c_str());
+		CImg<unsigned char> img = load_source();
 		if (1 > argument[0] or argument[0] > 10) dmimg::error("Wrong argument! This operation can take structural element from 1 to 10");
 
 		// start measuring time
@@ -1875,16 +6318,16 @@ int main(int argc, char** argv) {
 		// stop the timer
 		auto stop = std::chrono::high_resolution_clock::now();
 		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-		std::cout << "Applied in: " << duration.count() << " microseconds." << std::endl;
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// opening
 	auto opening = operations->add_option_group("opening", "opening operation");
 	opening->add_option("--opening", argument, "Apply opening of the image with specific structural element");
-	opening->callback([&]() {
+	opening->callback(operation([&]() {
 		using namespace dmimg;
-		CImg<unsigned char> img(source_file.c_str());
+		CImg<unsigned char> img = load_source();
 		if (1 > argument[0] or argument[0] > 10) dmimg::error("Wrong argument! This operation can take structural element from 1 to 10");
 
 		// start measuring time
@@ -1895,16 +6338,16 @@ int main(int argc, char** argv) {
 		// stop the timer
 		auto stop = std::chrono::high_resolution_clock::now();
 		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-		std::cout << "Applied in: " << duration.count() << " microseconds." << std::endl;
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// closing
 	auto closing = operations->add_option_group("closing", "closing operation");
 	closing->add_option("--closing", argument, "Apply closing of the image with specific structural element");
-	closing->callback([&]() {
+	closing->callback(operation([&]() {
 		using namespace dmimg;
-		CImg<unsigned char> img(source_file.c_str());
+		CImg<unsigned char> img = load_source();
 		if (1 > argument[0] or argument[0] > 10) dmimg::error("Wrong argument! This operation can take structural element from 1 to 10");
 
 		// start measuring time
@@ -1915,16 +6358,16 @@ int main(int argc, char** argv) {
 		// stop the timer
 		auto stop = std::chrono::high_resolution_clock::now();
 		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-		std::cout << "Applied in: " << duration.count() << " microseconds." << std::endl;
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// closing
 	auto hmt = operations->add_option_group("HMT transform", "Apply HMT transform with selected structuring element");
 	hmt->add_option("--hmt", argument, "Apply closing of the image with specific structural element");
-	hmt->callback([&]() {
+	hmt->callback(operation([&]() {
 		using namespace dmimg;
-		CImg<unsigned char> img(source_file.c_str());
+		CImg<unsigned char> img = load_source();
 		// start measuring time
 		auto start = std::chrono::high_resolution_clock::now();
 		// the function will return an error when the argument is out of range as hmt transform can use any structural element
@@ -1933,16 +6376,16 @@ int main(int argc, char** argv) {
 		// stop the timer
 		auto stop = std::chrono::high_resolution_clock::now();
 		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-		std::cout << "Applied in: " << duration.count() << " microseconds." << std::endl;
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// m5
 	auto m5 = operations->add_option_group("M5", "Apply M5");
 	m5->add_flag("--m5", "Apply M5");
-	m5->callback([&]() {
+	m5->callback(operation([&]() {
 		using namespace dmimg;
-		CImg<unsigned char> img(source_file.c_str());
+		CImg<unsigned char> img = load_source();
 		// start measuring time
 		auto start = std::chrono::high_resolution_clock::now();
 		// the function will return an error when the argument is out of range as hmt transform can use any structural element
@@ -1951,183 +6394,917 @@ int main(int argc, char** argv) {
 		// stop the timer
 		auto stop = std::chrono::high_resolution_clock::now();
 		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-		std::cout << "Applied in: " << duration.count() << " microseconds." << std::endl;
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	// m5 - slow version, one hmt per structural element
+	auto m5_slow = operations->add_option_group("M5 slow", "Apply M5 - slow version");
+	m5_slow->add_flag("--m5_slow", "Apply M5 - slow version");
+	m5_slow->callback(operation([&]() {
+		using namespace dmimg;
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
 
-		img.save(output_file.c_str());
-		});
+		dmimg::m5_slow(img);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	// HMT, thinning and thickening with the union of several structural elements
+	auto hmt_union = operations->add_option_group("HMT union", "Apply HMT transform with the union of selected structuring elements");
+	hmt_union->add_option("--hmt_union", argument, "Apply HMT transform with the union of the given structural elements in one pass");
+	hmt_union->callback(operation([&]() {
+		using namespace dmimg;
+		CImg<unsigned char> img = load_source();
+		std::vector<std::vector<xyval>> structural_els;
+		for (int el : argument) structural_els.push_back(dmimg::get_structural_element(el));
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::hmt_union(img, structural_els);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	auto thinning = operations->add_option_group("thinning", "Thinning with selected structuring elements");
+	thinning->add_option("--thinning", argument, "Apply thinning with the union of the given structural elements until there are no changes");
+	thinning->callback(operation([&]() {
+		using namespace dmimg;
+		CImg<unsigned char> img = load_source();
+		std::vector<std::vector<xyval>> structural_els;
+		for (int el : argument) structural_els.push_back(dmimg::get_structural_element(el));
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::thinning(img, structural_els);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	auto thickening = operations->add_option_group("thickening", "Thickening with selected structuring elements");
+	thickening->add_option("--thickening", argument, "Apply thickening with the union of the given structural elements until there are no changes");
+	thickening->callback(operation([&]() {
+		using namespace dmimg;
+		CImg<unsigned char> img = load_source();
+		std::vector<std::vector<xyval>> structural_els;
+		for (int el : argument) structural_els.push_back(dmimg::get_structural_element(el));
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::thickening(img, structural_els);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	// Euclidean distance transform
+	auto edt = operations->add_option_group("edt", "Euclidean distance transform");
+	edt->add_flag("--edt", "Distance of every pixel to the nearest foreground pixel, scaled to 0-255");
+	edt->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::distance_transform_image(img);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	// erosion and dilation with a disk of any radius
+	auto erosion_disk = operations->add_option_group("erosion disk", "erosion with a disk");
+	erosion_disk->add_option("--erosion_disk", argument, "Apply erosion of the image with a disk of given radius");
+	erosion_disk->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::erosion_disk(img, argument[0]);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	auto dilation_disk = operations->add_option_group("dilation disk", "dilation with a disk");
+	dilation_disk->add_option("--dilation_disk", argument, "Apply dilation of the image with a disk of given radius");
+	dilation_disk->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::dilation_disk(img, argument[0]);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	// reconstruction and geodesic operations
+	auto reconstruction = operations->add_option_group("reconstruction", "Reconstruction by dilation");
+	reconstruction->add_flag("--reconstruction", "Grayscale reconstruction by dilation of the marker image (--marker) under the source image");
+	reconstruction->callback(operation([&]() {
+		CImg<unsigned char> img(marker_file.c_str());
+		CImg<unsigned char> mask(source_file.c_str());
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::reconstruction(img, mask);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}, false));
+	auto reconstruction_bw = operations->add_option_group("reconstruction bw", "B&W reconstruction by dilation");
+	reconstruction_bw->add_flag("--reconstruction_bw", "Keep the objects of the source image which are touched by the marker image (--marker)");
+	reconstruction_bw->callback(operation([&]() {
+		CImg<unsigned char> img(marker_file.c_str());
+		CImg<unsigned char> mask(source_file.c_str());
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::reconstruction_bw(img, mask);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}, false));
+	auto fill_holes = operations->add_option_group("fill holes", "Hole filling");
+	fill_holes->add_flag("--fill_holes", "Fill the holes of the objects in b&w image");
+	fill_holes->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::fill_holes(img);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	auto clear_border = operations->add_option_group("clear border", "Border objects removal");
+	clear_border->add_flag("--clear_border", "Remove the objects touching the border of b&w image");
+	clear_border->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::clear_border(img);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	auto rmax = operations->add_option_group("regional maxima", "Regional maxima");
+	rmax->add_flag("--rmax", "Mark regional maxima of grayscale image");
+	rmax->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::regional_maxima(img);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	auto rmin = operations->add_option_group("regional minima", "Regional minima");
+	rmin->add_flag("--rmin", "Mark regional minima of grayscale image");
+	rmin->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::regional_minima(img);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	auto hdomes = operations->add_option_group("h-domes", "H-domes");
+	hdomes->add_option("--hdomes", argument, "Compute h-domes of grayscale image with given h");
+	hdomes->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::h_domes(img, argument[0]);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
 	// region growin (merging)
 	auto merging = operations->add_option_group("merging", "Region merging");
 	merging->add_option("--merging", argument, "Region merging");
-	merging->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	merging->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
 		// void (CImg<T>& img, int seedX, int seedY, int threshold)
 		dmimg::perform_merging(img, argument[0], argument[1], argument[2]);
-		img.save(output_file.c_str());
-		});
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	// region growin (merging) - slow version
+	auto merging_slow = operations->add_option_group("merging slow", "Region merging - slow version");
+	merging_slow->add_option("--merging_slow", argument, "Region merging - slow version");
+	merging_slow->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+		// void (CImg<T>& img, int seedX, int seedY, int threshold)
+		dmimg::perform_merging_slow(img, argument[0], argument[1], argument[2]);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	// full image segmentation
+	auto segmentation = operations->add_option_group("segmentation", "Full image segmentation");
+	segmentation->add_option("--segmentation", argument, "Label all the regions of the image, neighbouring pixels within the colour threshold (argument) are merged. Regions are painted with their mean colour");
+	segmentation->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		CImg<std::uint32_t> labels;
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		std::vector<dmimg::Region_stats> stats = dmimg::label_regions(img, labels, argument[0]);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Number of regions: " << stats.size() - 1 << std::endl;
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		dmimg::paint_regions(img, labels, stats);
+		save_output(img);
+		}));
+	auto segmentation_bw = operations->add_option_group("segmentation bw", "Full b&w image segmentation");
+	segmentation_bw->add_flag("--segmentation_bw", "Label all the regions of b&w image. Regions are painted with their mean colour");
+	segmentation_bw->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		CImg<std::uint32_t> labels;
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		std::vector<dmimg::Region_stats> stats = dmimg::label_regions_bw(img, labels);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Number of regions: " << stats.size() - 1 << std::endl;
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		dmimg::paint_regions(img, labels, stats);
+		save_output(img);
+		}));
+	// watershed segmentation
+	auto watershed = operations->add_option_group("watershed", "Watershed segmentation");
+	watershed->add_flag("--watershed", "Watershed segmentation of the gradient of the image. Markers are taken from b&w image given with --marker or regional minima of the gradient are used. Borders of the regions are drawn in red");
+	watershed->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		CImg<unsigned char> marker;
+		if (!marker_file.empty()) marker.load(marker_file.c_str());
+		CImg<std::uint32_t> labels;
+		// start measuring time
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::watershed(img, labels, marker_file.empty() ? nullptr : &marker);
+
+		// stop the timer
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Applied in: " << duration.count() << " microseconds." << std::endl;
+
+		dmimg::draw_region_borders(img, labels);
+		save_output(img);
+		}));
 	// ######################################################################
 	// Task 4 
 	//
 	auto slow_normal_descrete_fourier_transform = operations->add_option_group("sndft", "Perform slow normal descrete Fourier Transform");
 	slow_normal_descrete_fourier_transform->add_flag("--sndft", "Transform image using slow normal descrete Fourier Transform");
-	slow_normal_descrete_fourier_transform->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	slow_normal_descrete_fourier_transform->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 
 		std::vector<std::vector<std::complex<double>>> fourier;
 		fourier = dmimg::perform_slow_normal_descrete_fourier_transform(img);
-		fourier = dmimg::swap_quarters(fourier);
+		dmimg::swap_quarters(fourier);
 		img = dmimg::visualisation_image(fourier);
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	// 
 	auto slow_inversed__descrete_fourier_transform = operations->add_option_group("sidft", "Perform slow inverse descrete Fourier Transform");
 	slow_inversed__descrete_fourier_transform->add_flag("--sidft", "Convert image using slow inverse descrete Fourier Transform");
-	slow_inversed__descrete_fourier_transform->callback([&]() {
-		CImg<unsigned char> img1(source_file.c_str());
-		CImg<unsigned char> img2(source_file.c_str());
+	slow_inversed__descrete_fourier_transform->callback(operation([&]() {
+		CImg<unsigned char> img1 = load_source();
+		CImg<unsigned char> img2;
 
 		std::vector<std::vector<std::complex<double>>> fourier;
 		fourier = dmimg::perform_slow_normal_descrete_fourier_transform(img1);
-		fourier = dmimg::swap_quarters(fourier);
+		dmimg::swap_quarters(fourier);
 		img1 = dmimg::visualisation_image(fourier);
 
-		img1.save("DFT_comparison.bmp");
+		// the spectrum for comparison, not in batch mode (every image would write the same file)
+		if (batch_paths.empty()) img1.save("DFT_comparison.bmp");
 
 		img2 = dmimg::perform_slow_inversed__descrete_fourier_transform(fourier);
 		//img2 = dmimg::visualisation_image(fourier);
 
-		img2.save(output_file.c_str());
-		});
+		save_output(img2);
+		}));
+	auto dft_bins = operations->add_option_group("dft_bins", "Chosen bins of the discrete Fourier Transform");
+	dft_bins->add_option("--dft_bins", argument, "Values of the given bins of the spectrum (red channel, not centered), pairs u v, e.g. periodic noise at (12, 0) and (0, 40): --dft_bins 12 0 0 40. Computed with Goertzel recurrences, any image size");
+	dft_bins->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		if (argument.size() % 2 != 0) dmimg::error("dft bins: give pairs u v");
+		std::vector<std::pair<int, int>> bins;
+		for (size_t i = 0; i < argument.size(); i += 2) bins.emplace_back(argument[i], argument[i + 1]);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		std::vector<std::complex<double>> values = dmimg::dft_bins(img, bins);
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		for (size_t i = 0; i < bins.size(); i++) {
+			messages() << "(" << bins[i].first << ", " << bins[i].second << "): " << values[i] << ", magnitude " << std::abs(values[i]) << ", phase " << std::arg(values[i]) << std::endl;
+		}
+		messages() << "Computed in: " << duration.count() << " microseconds." << std::endl;
+		}, false));
+	auto dft_benchmark = operations->add_option_group("dft_benchmark", "Direct dft and Goertzel bins compared with the fft");
+	dft_benchmark->add_flag("--dft_benchmark", "Direct dft with the trig tables, the same with cos and sin for every term (the old way) and 8 Goertzel bins, compared with the fft of the image. Prints the times and the largest differences relative to the largest value of the spectrum");
+	dft_benchmark->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		const int width = img.width();
+		const int height = img.height();
+		auto microseconds = [](std::chrono::high_resolution_clock::time_point start) {
+			return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+		};
+		dmimg::Complex_matrix fft_spectrum = dmimg::fft_spatial_domain(img);
+		double largest = 0;
+		for (size_t i = 0; i < fft_spectrum.size(); i++) largest = std::max(largest, std::abs(fft_spectrum.data()[i]));
+
+		auto start = std::chrono::high_resolution_clock::now();
+		dmimg::Complex_matrix spectrum = dmimg::dft_2D(img);
+		long long table_duration = microseconds(start);
+		double table_error = 0;
+		for (size_t i = 0; i < spectrum.size(); i++) table_error = std::max(table_error, std::abs(spectrum.data()[i] - fft_spectrum.data()[i]));
+
+		// one row of the old way: cos and sin for every term
+		start = std::chrono::high_resolution_clock::now();
+		std::vector<std::complex<double>> row(width);
+		for (int u = 0; u < width; u++) {
+			for (int x = 0; x < width; x++) {
+				row[u] += double(img(x, 0)) * std::complex<double>(std::cos(2 * dmimg::value_pi_double * x * u / width), -std::sin(2 * dmimg::value_pi_double * x * u / width));
+			}
+		}
+		// a row costs width^2 terms, the whole dft width * height * (width + height)
+		long long trig_duration = (long long)(microseconds(start) * (height + double(height) * height / width));
+
+		std::vector<std::pair<int, int>> bins;
+		for (int i = 0; i < 8; i++) bins.emplace_back((i * 37 + 1) % width, (i * 53) % height);
+		start = std::chrono::high_resolution_clock::now();
+		std::vector<std::complex<double>> values = dmimg::dft_bins(img, bins);
+		long long bins_duration = microseconds(start);
+		double bins_error = 0;
+		for (size_t i = 0; i < bins.size(); i++) bins_error = std::max(bins_error, std::abs(values[i] - fft_spectrum(bins[i].first, bins[i].second)));
+
+		messages() << "dft with tables: " << table_duration << " microseconds, max difference " << table_error / largest << std::endl;
+		messages() << "dft with cos and sin (estimated from one row): " << trig_duration << " microseconds" << std::endl;
+		messages() << "8 Goertzel bins: " << bins_duration << " microseconds, max difference " << bins_error / largest << std::endl;
+		}, false));
 	auto fft = operations->add_option_group("fft", "Perform Fast Fourier Transform");
 	fft->add_flag("--fft", "Transform image using Fast Fourier Transform");
-	fft->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	fft->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 
-		auto fourier = std::make_shared<std::vector<std::vector<std::complex<double>>>>();
+		img = dmimg::fft_spectrum_image(img);
 
-		fourier = dmimg::fft_spatial_domain(img);
-		fourier = dmimg::swap_quarters_ptr(*fourier);
-		img = dmimg::image_from_complex(*fourier);
+		save_output(img);
+		}));
+	auto fft_export = operations->add_option_group("fft_export", "Export of the spectrum to numpy files");
+	std::string export_name = "";
+	fft_export->add_option("--fft_export", export_name, "Save the spectrum of the image (centered, as --fft shows it) as name_magnitude.npy and name_phase.npy (float32) and name_complex.npy (complex64), shape (height, width), with --fft_color (3, height, width)");
+	fft_export->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 
-		img.save(output_file.c_str());
-		});
+		auto start = std::chrono::high_resolution_clock::now();
+		dmimg::fft_export_spectrum(img, export_name);
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Spectrum exported in: " << duration.count() << " microseconds." << std::endl;
+		}, false));
 	auto fft_inverse = operations->add_option_group("fft_inverse", "Perform Inverse Fast Fourier Transform");
 	fft_inverse->add_flag("--ffti", "Transform image using inverse Fast Fourier Transform");
-	fft_inverse->callback([&]() {
-
-		CImg<unsigned char> img1(source_file.c_str());
-		CImg<unsigned char> img2(source_file.c_str());
+	fft_inverse->callback(operation([&]() {
 
-		auto fourier = std::make_shared<std::vector<std::vector<std::complex<double>>>>();
+		CImg<unsigned char> img2 = load_source();
 
-		fourier = dmimg::fft_spatial_domain(img1);
-		fourier = dmimg::swap_quarters_ptr(*fourier);
-		img1 = dmimg::image_from_complex(*fourier);
-
-		img1.save("FFT_comparison.bmp");
-		img2 = dmimg::fft_inverse_2D_img(*fourier);
+		// the spectrum for comparison, not in batch mode (every image would write the same file)
+		if (batch_paths.empty()) {
+			CImg<unsigned char> img1 = dmimg::fft_spectrum_image(img2);
+			img1.save("FFT_comparison.bmp");
+		}
+		img2 = dmimg::fft_filter_image(img2, nullptr);
 
-		img2.save(output_file.c_str());
+		save_output(img2);
 
-		});
+		}));
 	auto fft_hp = operations->add_option_group("ffthp", "Perform High Pass Filter with Fast Fourier Transform");
 	fft_hp->add_option("--ffthp", argument, "Transform image using Fast Fourier Transform - high pass");
-	fft_hp->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
-
-		auto fourier = std::make_shared<std::vector<std::vector<std::complex<double>>>>();
+	fft_hp->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 
-		fourier = dmimg::fft_spatial_domain(img);
-		fourier = dmimg::swap_quarters_ptr(*fourier);
-		dmimg::high_pass_filter(*fourier, argument[0]);
-		img = dmimg::fft_inverse_2D_img(*fourier);
-		//img = dmimg::image_from_complex(*fourier);
+		auto filter = dmimg::make_high_pass_filter(img.width(), img.height(), argument[0]);
+		img = dmimg::fft_filter_image(img, &filter);
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto fft_hped = operations->add_option_group("ffthped", "Perform High Pass Filter with edge detection");
 	fft_hped->add_option("--ffthped", argument, "Transform image using Fast Fourier Transform - high pass with edge detection. Function takes three arguments: angle (degrees), width (degrees), radius (units), is X axxis the base ( 1 or 0 )");
-	fft_hped->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
-
-		auto fourier = std::make_shared<std::vector<std::vector<std::complex<double>>>>();
+	fft_hped->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 
-		fourier = dmimg::fft_spatial_domain(img);
-		fourier = dmimg::swap_quarters_ptr(*fourier);
-		dmimg::high_pass_filter_edge_detection(*fourier, argument[0], argument[1], argument[2], argument[3]);
-		img = dmimg::fft_inverse_2D_img(*fourier);
-		//img = dmimg::image_from_complex(*fourier);
+		auto filter = dmimg::make_edge_detection_filter(img.width(), img.height(), argument[0], argument[1], argument[2], argument[3]);
+		img = dmimg::fft_filter_image(img, &filter);
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto fft_pmf = operations->add_option_group("fftpmf", "Perform Phase Modifying Filter");
 	fft_pmf->add_option("--fftpmf", argument, "Transform image using Fast Fourier Transform - phase modifying fiter. Function takes two arguments: l and k");
-	fft_pmf->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
-
-		auto fourier = std::make_shared<std::vector<std::vector<std::complex<double>>>>();
+	fft_pmf->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 
-		fourier = dmimg::fft_spatial_domain(img);
-		fourier = dmimg::swap_quarters_ptr(*fourier);
-		dmimg::phase_modifying_filter(*fourier, argument[0], argument[1]);
-		img = dmimg::fft_inverse_2D_img(*fourier);
-		//img = dmimg::image_from_complex(*fourier);
+		auto filter = dmimg::make_phase_modifying_filter(img.width(), img.height(), argument[0], argument[1]);
+		img = dmimg::fft_filter_image(img, &filter);
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto fft_lpf = operations->add_option_group("fftlpf", "Perform Low-pass filter");
 	fft_lpf->add_option("--fftlpf", argument, "Transform image using Fast Fourier Transform -> low-pass fiter. Takes 1 argument = threshold");
-	fft_lpf->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
-
-		auto fourier = std::make_shared<std::vector<std::vector<std::complex<double>>>>();
+	fft_lpf->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 
-		fourier = dmimg::fft_spatial_domain(img);
-		fourier = dmimg::swap_quarters_ptr(*fourier);
-		dmimg::lowpass_filter(*fourier, argument[0]);
-		img = dmimg::fft_inverse_2D_img(*fourier);
-		//img = dmimg::image_from_complex(*fourier);
+		auto filter = dmimg::make_lowpass_filter(img.width(), img.height(), argument[0]);
+		img = dmimg::fft_filter_image(img, &filter);
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto fft_bpf = operations->add_option_group("fftbpf", "Perform Band-pass filter");
 	fft_bpf->add_option("--fftbpf", argument, "Transform image using Fast Fourier Transform -> band-pass fiter. Takes 2 arguments: threshold and width.");
-	fft_bpf->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
-
-		auto fourier = std::make_shared<std::vector<std::vector<std::complex<double>>>>();
+	fft_bpf->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
 
-		fourier = dmimg::fft_spatial_domain(img);
-		fourier = dmimg::swap_quarters_ptr(*fourier);
-		dmimg::bandpass_filter(*fourier, argument[0], argument[1]);
-		img = dmimg::fft_inverse_2D_img(*fourier);
-		//img = dmimg::image_from_complex(*fourier);
+		auto filter = dmimg::make_bandpass_filter(img.width(), img.height(), argument[0], argument[1]);
+		img = dmimg::fft_filter_image(img, &filter);
 
-		img.save(output_file.c_str());
-		});
+		save_output(img);
+		}));
 	auto fft_bcf = operations->add_option_group("fftbcf", "Perform Band-cut filter");
 	fft_bcf->add_option("--fftbcf", argument, "Transform image using Fast Fourier Transform -> band-cut fiter. Takes 2 arguments: threshold and width.");
-	fft_bcf->callback([&]() {
-		CImg<unsigned char> img(source_file.c_str());
+	fft_bcf->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+
+		auto filter = dmimg::make_bandcut_filter(img.width(), img.height(), argument[0], argument[1]);
+		img = dmimg::fft_filter_image(img, &filter);
+
+		save_output(img);
+		}));
+	auto image_registration = operations->add_option_group("register", "Translation of frames against the source image");
+	std::vector<std::string> frame_files;
+	image_registration->add_option("--register", frame_files, "Shifts (dx, dy) of the frames against the source image by phase correlation, to a fraction of a pixel: frame(x, y) = source(x - dx, y - dy). The spectrum of the source is computed once for all the frames. Prints the shift, the correlation peak (1: the same content, near 0: unrelated) and the time of every frame");
+	image_registration->callback(operation([&]() {
+		CImg<unsigned char> reference(source_file.c_str());
+		auto microseconds = [](std::chrono::high_resolution_clock::time_point start) {
+			return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+		};
+
+		auto start = std::chrono::high_resolution_clock::now();
+		dmimg::Phase_correlator correlator(reference);
+		messages() << "Reference spectrum (scale " << correlator.scale() << ") computed in: " << microseconds(start) << " microseconds." << std::endl;
+		long long total = 0;
+		for (const std::string& frame_file : frame_files) {
+			CImg<unsigned char> frame(frame_file.c_str());
+			start = std::chrono::high_resolution_clock::now();
+			dmimg::Registration registration = correlator.register_frame(frame);
+			long long duration = microseconds(start);
+			total += duration;
+			messages() << frame_file << ": dx " << registration.dx << ", dy " << registration.dy << ", peak " << registration.response << ", " << duration << " microseconds" << std::endl;
+		}
+		if (!frame_files.empty()) messages() << "Registered in: " << total / (long long)frame_files.size() << " microseconds per frame." << std::endl;
+		}, false));
+	auto match_template = operations->add_option_group("match_template", "Template matching by normalized cross-correlation");
+	std::string template_file = "";
+	match_template->add_option("--match_template", template_file, "Find the template in the source image (and --match_images): the best --match_count positions of the top left corner of the template, which are not closer than half of the template size, with their normalized cross-correlation (1: the same up to brightness and contrast). With an output file, the correlation map of every image is saved there (output_1, output_2... for --match_images), -1 black, 1 white");
+	match_template->callback(operation([&]() {
+		CImg<unsigned char> template_img(template_file.c_str());
+		auto microseconds = [](std::chrono::high_resolution_clock::time_point start) {
+			return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+		};
+		dmimg::Template_matcher matcher(template_img);
+		std::vector<std::string> image_files = { source_file };
+		image_files.insert(image_files.end(), match_images.begin(), match_images.end());
+		for (size_t i = 0; i < image_files.size(); i++) {
+			CImg<unsigned char> img(image_files[i].c_str());
+
+			auto start = std::chrono::high_resolution_clock::now();
+			dmimg::Correlation_map map = matcher.match(img);
+			std::vector<dmimg::Template_match> matches = dmimg::top_matches(map, match_count, matcher.width(), matcher.height());
+			long long duration = microseconds(start);
+			messages() << image_files[i] << " (" << duration << " microseconds):" << std::endl;
+			for (const dmimg::Template_match& match : matches) {
+				messages() << "  (" << match.x << ", " << match.y << "): " << match.score << std::endl;
+			}
+			if (!output_file.empty()) {
+				std::string map_file = (i == 0) ? output_file : dmimg::filter_bank_output_path(output_file, int(i));
+				dmimg::correlation_map_image(map).save(map_file.c_str());
+			}
+		}
+		}, false));
+	auto convolve = operations->add_option_group("convolve", "Convolution with any kernel");
+	std::string kernel_file = "";
+	convolve->add_option("--convolve", kernel_file, "Convolve all channels of the image with the kernel from the file (width, height, then the values row by row, centered at (width / 2, height / 2)). The method is chosen with --convolution_method");
+	convolve->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		dmimg::Convolution_kernel kernel = dmimg::load_kernel(kernel_file);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		dmimg::Convolution_method method = dmimg::convolve(img, kernel, dmimg::convolution_method);
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Convolution (" << dmimg::convolution_method_name(method) << ") applied in: " << duration.count() << " microseconds." << std::endl;
+
+		save_output(img);
+		}));
+	auto convolution_benchmark = operations->add_option_group("convolution_benchmark", "Methods of convolution compared");
+	convolution_benchmark->add_option("--convolution_benchmark", argument, "Convolution of the image with gaussian kernels of the given sizes (for example 3 15 63) by every method. Prints the time of each one, the largest difference from the direct convolution and the method chosen automatically");
+	convolution_benchmark->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		for (int size : argument) {
+			dmimg::Convolution_kernel kernel = dmimg::make_gaussian_kernel(size);
+			messages() << "kernel " << size << "x" << size << ", chosen: " << dmimg::convolution_method_name(dmimg::choose_convolution_method(img.width(), img.height(), kernel, true)) << std::endl;
+			CImg<unsigned char> direct_img;
+			for (dmimg::Convolution_method method : { dmimg::Convolution_method::direct, dmimg::Convolution_method::separable, dmimg::Convolution_method::fft }) {
+				CImg<unsigned char> result = img;
+				auto start = std::chrono::high_resolution_clock::now();
+				dmimg::convolve(result, kernel, method);
+				auto stop = std::chrono::high_resolution_clock::now();
+				auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+				if (method == dmimg::Convolution_method::direct) direct_img = result;
+				int difference = 0;
+				for (int c = 0; c < result.spectrum(); c++) {
+					for (int y = 0; y < result.height(); y++) {
+						for (int x = 0; x < result.width(); x++) {
+							difference = std::max(difference, std::abs(int(result(x, y, 0, c)) - int(direct_img(x, y, 0, c))));
+						}
+					}
+				}
+				messages() << "  " << dmimg::convolution_method_name(method) << ": " << duration.count() << " microseconds, max difference " << difference << std::endl;
+			}
+		}
+		}, false));
+	auto fft_filter_bank = operations->add_option_group("fft_filter_bank", "Many fft filters applied to one spectrum");
+	std::string filter_bank_file = "";
+	fft_filter_bank->add_option("--fft_filter_bank", filter_bank_file, "Apply every filter of the file to the image, the spectrum is computed once (or loaded from --spectrum_cache). One filter per line: the name of the option without fft and its arguments, e.g. lpf 40, bpf 40 10, hped 30 20 10 1. Result i is saved as output_i with the extension of the output");
+	fft_filter_bank->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		std::ifstream file(filter_bank_file);
+		if (!file) dmimg::error("Can't read filter bank file " + filter_bank_file);
+		std::vector<std::unique_ptr<dmimg::Frequency_filter>> filters;
+		std::string line;
+		while (std::getline(file, line)) {
+			if (line.find_first_not_of(" \t\r") == std::string::npos or line[0] == '#') continue;
+			filters.push_back(dmimg::make_frequency_filter(line, img.width(), img.height()));
+		}
 
-		auto fourier = std::make_shared<std::vector<std::vector<std::complex<double>>>>();
+		auto start = std::chrono::high_resolution_clock::now();
+		std::vector<CImg<unsigned char>> outputs = dmimg::fft_filter_bank(img, filters);
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << filters.size() << " filters applied in: " << duration.count() << " microseconds." << std::endl;
 
-		fourier = dmimg::fft_spatial_domain(img);
-		fourier = dmimg::swap_quarters_ptr(*fourier);
-		dmimg::bandcut_filter(*fourier, argument[0], argument[1]);
-		img = dmimg::fft_inverse_2D_img(*fourier);
-		//img = dmimg::image_from_complex(*fourier);
+		for (size_t i = 0; i < outputs.size(); i++) {
+			outputs[i].save(dmimg::filter_bank_output_path(output_file, int(i)).c_str());
+		}
+		}, false));
+	auto convolve_out_of_core = operations->add_option_group("convolve_out_of_core", "Convolution of an image larger than the memory");
+	std::string out_of_core_kernel_file = "";
+	convolve_out_of_core->add_option("--convolve_out_of_core", out_of_core_kernel_file, "The same as --convolve, but the image (an uncompressed bmp or a binary ppm file) is read and the output written a band of rows at a time, within --mem-limit. The output is a bmp, or a ppm if its name ends with .ppm (a bmp can't be larger than 4 GB)");
+	convolve_out_of_core->callback(operation([&]() {
+		dmimg::Convolution_kernel kernel = dmimg::load_kernel(out_of_core_kernel_file);
 
-		img.save(output_file.c_str());
-		});
+		auto start = std::chrono::high_resolution_clock::now();
+		dmimg::Convolution_method method = dmimg::convolve_out_of_core(source_file, output_file, kernel, dmimg::convolution_method);
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Convolution (" << dmimg::convolution_method_name(method) << ", out-of-core) applied in: " << duration.count() << " microseconds." << std::endl;
+		}, false));
+	auto fft_filter_out_of_core = operations->add_option_group("fft_filter_out_of_core", "Fft filter of an image larger than the memory");
+	std::string out_of_core_filter = "";
+	fft_filter_out_of_core->add_option("--fft_filter_out_of_core", out_of_core_filter, "Apply the fft filter (written as a line of --fft_filter_bank, e.g. \"lpf 40\") to an uncompressed bmp or a binary ppm file larger than the memory: the rows and the columns are transformed through a scratch file (output.scratch) within --mem-limit. The output is a bmp, or a ppm if its name ends with .ppm (a bmp can't be larger than 4 GB)");
+	fft_filter_out_of_core->callback(operation([&]() {
+		int width = 0, height = 0;
+		{
+			dmimg::Band_reader reader(source_file);
+			width = reader.width();
+			height = reader.height();
+		}
+		auto filter = dmimg::make_frequency_filter(out_of_core_filter, width, height);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		dmimg::fft_filter_out_of_core(source_file, output_file, filter.get());
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << "Out-of-core fft filter applied in: " << duration.count() << " microseconds." << std::endl;
+		}, false));
+	auto fft_benchmark = operations->add_option_group("fft_benchmark", "Compare vector of vectors and contiguous matrix in fft");
+	fft_benchmark->add_flag("--fft_benchmark", "Forward and inverse fft of the image stored as vector of vectors and as contiguous matrix. Prints the time of both and the number of allocations (when built with DMIMG_COUNT_ALLOCATIONS)");
+	fft_benchmark->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// warm up the tables cache so that both versions start equally
+		dmimg::get_fft_tables(img.width());
+		dmimg::get_fft_tables(img.height());
+		dmimg::get_fft_tables(img.width() / 2);
+		messages() << "rows: " << dmimg::fft_plan_description(img.width()) << ", columns: " << dmimg::fft_plan_description(img.height()) << std::endl;
+		{
+			long long allocations_before = allocations_made();
+			auto start = std::chrono::high_resolution_clock::now();
+
+			auto fourier = dmimg::image_to_complex(img);
+			dmimg::fast_fourier_2D(*fourier);
+			dmimg::fft_inverse_2D(*fourier);
+
+			auto stop = std::chrono::high_resolution_clock::now();
+			auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+			messages() << "vector of vectors: " << allocations_since(allocations_before) << duration.count() << " microseconds." << std::endl;
+		}
+		{
+			long long allocations_before = allocations_made();
+			auto start = std::chrono::high_resolution_clock::now();
+
+			dmimg::Complex_matrix fourier = dmimg::image_to_complex_matrix(img);
+			dmimg::fast_fourier_2D(fourier);
+			dmimg::fft_inverse_2D(fourier);
+
+			auto stop = std::chrono::high_resolution_clock::now();
+			auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+			messages() << "contiguous matrix: " << allocations_since(allocations_before) << duration.count() << " microseconds." << std::endl;
+		}
+		if (img.width() % 2 == 0) {
+			long long allocations_before = allocations_made();
+			auto start = std::chrono::high_resolution_clock::now();
+
+			dmimg::Complex_matrix half_spectrum = dmimg::fft_spatial_domain_half(img);
+			dmimg::fft_inverse_2D_half(half_spectrum);
+
+			auto stop = std::chrono::high_resolution_clock::now();
+			auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+			messages() << "real input, half spectrum: " << allocations_since(allocations_before) << duration.count() << " microseconds." << std::endl;
+		}
+		}, false));
+	auto fft_plan_benchmark = operations->add_option_group("fft_plan_benchmark", "Cost of fft planning and of executing a plan");
+	fft_plan_benchmark->add_flag("--fft_plan_benchmark", "Makes forward and inverse fft plans for the image size (with --fft_planning), then executes them 10 times. Prints the planning time and the time of one execution");
+	fft_plan_benchmark->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::Fft_plan forward(img.width(), img.height(), dmimg::Fft_direction::forward, dmimg::fft_planning_mode);
+		dmimg::Fft_plan inverse(img.width(), img.height(), dmimg::Fft_direction::inverse, dmimg::fft_planning_mode);
+
+		auto stop = std::chrono::high_resolution_clock::now();
+		auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+		messages() << forward.description() << std::endl;
+		messages() << "Planning: " << duration.count() << " microseconds." << std::endl;
+
+		const int runs = 10;
+		long long forward_duration = 0;
+		long long inverse_duration = 0;
+		for (int run = 0; run < runs; run++) {
+			auto forward_start = std::chrono::high_resolution_clock::now();
+			dmimg::Complex_matrix half_spectrum = forward.execute(img);
+			auto forward_stop = std::chrono::high_resolution_clock::now();
+			inverse.execute(half_spectrum);
+			auto inverse_stop = std::chrono::high_resolution_clock::now();
+			forward_duration += std::chrono::duration_cast<std::chrono::microseconds>(forward_stop - forward_start).count();
+			inverse_duration += std::chrono::duration_cast<std::chrono::microseconds>(inverse_stop - forward_stop).count();
+		}
+		messages() << "Forward execute: " << forward_duration / runs << " microseconds." << std::endl;
+		messages() << "Inverse execute: " << inverse_duration / runs << " microseconds." << std::endl;
+		}, false));
+	auto fft_scaling = operations->add_option_group("fft_scaling", "Fft filtering with growing number of threads");
+	fft_scaling->add_flag("--fft_scaling", "Forward fft, low pass filter (radius of a quarter of the width) and inverse fft with 1, 2, 4... threads. Prints the time, the speedup and checks that the results are identical");
+	fft_scaling->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		std::vector<int> threads_counts;
+		for (int threads_count = 1; threads_count < dmimg::default_threads_count(); threads_count *= 2) {
+			threads_counts.push_back(threads_count);
+		}
+		threads_counts.push_back(dmimg::default_threads_count());
+		CImg<unsigned char> reference;
+		long long reference_duration = 0;
+		for (int threads_count : threads_counts) {
+			dmimg::set_threads_count(threads_count);
+			// warm up the tables cache and the threads
+			dmimg::Complex_matrix warm_up = dmimg::fft_spatial_domain_half(img);
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			dmimg::Complex_matrix fourier = dmimg::fft_spatial_domain_half(img);
+			dmimg::lowpass_filter(fourier, img.width() / 4);
+			CImg<unsigned char> result = dmimg::fft_inverse_2D_img_half(fourier);
+
+			auto stop = std::chrono::high_resolution_clock::now();
+			auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+			if (threads_count == 1) {
+				reference = result;
+				reference_duration = duration.count();
+			}
+			bool identical = std::equal(result.data(), result.data() + result.size(), reference.data());
+			messages() << threads_count << " threads: " << duration.count() << " microseconds, speedup "
+				<< double(reference_duration) / std::max<long long>(1, duration.count())
+				<< (identical ? ", identical result." : ", DIFFERENT result!") << std::endl;
+		}
+		}, false));
+	auto fft_color_benchmark = operations->add_option_group("fft_color_benchmark", "Color fft with real input transforms compared with a complex fft of every channel");
+	fft_color_benchmark->add_flag("--fft_color_benchmark", "Forward and inverse fft of all 3 channels: with the real input fft (color mode) and with the complex fft of every channel. Prints the time of both and checks that the results are the same");
+	fft_color_benchmark->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		// warm up the plans and the threads
+		dmimg::Color_spectrum warm_up = dmimg::fft_spatial_domain_color(img);
+		dmimg::Complex_matrix warm_up_full = dmimg::fft_spatial_domain(img);
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dmimg::Color_spectrum spectrum = dmimg::fft_spatial_domain_color(img);
+		CImg<unsigned char> color = dmimg::fft_inverse_2D_img_color(spectrum);
+
+		auto middle = std::chrono::high_resolution_clock::now();
+
+		CImg<unsigned char> separate(img.width(), img.height(), 1, 3);
+		for (int c = 0; c < 3; c++) {
+			dmimg::Complex_matrix fourier = dmimg::fft_spatial_domain(img, c);
+			CImg<unsigned char> channel = dmimg::fft_inverse_2D_img(fourier);
+			for (int y = 0; y < img.height(); y++) {
+				for (int x = 0; x < img.width(); x++) {
+					separate(x, y, 0, c) = channel(x, y);
+				}
+			}
+		}
+
+		auto stop = std::chrono::high_resolution_clock::now();
+		bool identical = std::equal(color.data(), color.data() + color.size(), separate.data());
+		long long color_duration = std::chrono::duration_cast<std::chrono::microseconds>(middle - start).count();
+		long long separate_duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - middle).count();
+		messages() << "Real input fft of 3 channels: " << color_duration << " microseconds." << std::endl;
+		messages() << "Complex fft of every channel: " << separate_duration << " microseconds." << std::endl;
+		messages() << "Speedup " << double(separate_duration) / std::max<long long>(1, color_duration)
+			<< (identical ? ", identical result." : ", DIFFERENT result!") << std::endl;
+		}, false));
+	auto fft_precision_benchmark = operations->add_option_group("fft_precision_benchmark", "Float fft compared with double fft");
+	fft_precision_benchmark->add_flag("--fft_precision_benchmark", "Round trip (forward and inverse fft) in float and low pass filter (radius of a quarter of the width) in float and in double. Prints the largest errors in gray levels (PASS below 0.5) and the time of the forward and inverse fft in both precisions");
+	fft_precision_benchmark->callback(operation([&]() {
+		CImg<unsigned char> img = load_source();
+		const int width = img.width();
+		const int height = img.height();
+
+		auto low_pass = dmimg::make_lowpass_filter(width, height, width / 4);
+		dmimg::Complex_matrix_float round_trip = dmimg::fft_spatial_domain_half<float>(img);
+		dmimg::fft_inverse_2D_half(round_trip);
+		dmimg::Complex_matrix_float filtered_float = dmimg::fft_spatial_domain_half<float>(img);
+		dmimg::fft_inverse_2D_half(filtered_float, &low_pass);
+		dmimg::Complex_matrix filtered_double = dmimg::fft_spatial_domain_half(img);
+		dmimg::fft_inverse_2D_half(filtered_double, &low_pass);
+		double round_trip_error = 0;
+		double filter_error = 0;
+		for (int y = 0; y < height; y++) {
+			const float* round_trip_samples = reinterpret_cast<const float*>(round_trip.row(y));
+			const float* float_samples = reinterpret_cast<const float*>(filtered_float.row(y));
+			const double* double_samples = reinterpret_cast<const double*>(filtered_double.row(y));
+			for (int x = 0; x < width; x++) {
+				round_trip_error = std::max(round_trip_error, std::abs(round_trip_samples[x] - double(dmimg::get_r(img, x, y))));
+				filter_error = std::max(filter_error, std::abs(float_samples[x] - double_samples[x]));
+			}
+		}
+		messages() << "Round trip in float, max error: " << round_trip_error << " gray levels." << std::endl;
+		messages() << "Low pass filter in float and in double, max difference: " << filter_error << " gray levels." << std::endl;
+		messages() << ((round_trip_error < 0.5 and filter_error < 0.5) ? "PASS" : "FAIL") << std::endl;
+
+		// the best of 5 runs of forward and inverse fft
+		auto best_duration = [](const std::function<void()>& transform) {
+			long long best = std::numeric_limits<long long>::max();
+			for (int run = 0; run < 5; run++) {
+				auto start = std::chrono::high_resolution_clock::now();
+				transform();
+				auto stop = std::chrono::high_resolution_clock::now();
+				best = std::min<long long>(best, std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count());
+			}
+			return best;
+		};
+		long long double_duration = best_duration([&]() {
+			dmimg::Complex_matrix half_spectrum = dmimg::fft_spatial_domain_half(img);
+			dmimg::fft_inverse_2D_half(half_spectrum);
+			});
+		long long float_duration = best_duration([&]() {
+			dmimg::Complex_matrix_float half_spectrum = dmimg::fft_spatial_domain_half<float>(img);
+			dmimg::fft_inverse_2D_half(half_spectrum);
+			});
+		messages() << "double: " << double_duration << " microseconds." << std::endl;
+		messages() << "float" << (dmimg::fft_avx2 ? " (AVX2)" : "") << ": " << float_duration << " microseconds, speedup "
+			<< double(double_duration) / std::max<long long>(1, float_duration) << std::endl;
+		}, false));
 	//	
 	//---------------------------------------------------------
 
 	// quiet mode of delivering exceptions, window will not be launched
 	cimg::exception_mode(0);
+	// 4 when some images of the batch failed
+	int exit_code = 0;
 	try {
 
 		app.parse(argc, argv);
+		if (!batch_paths.empty()) {
+			if (batch_paths.size() != 2) dmimg::error("--batch needs an input and an output directory");
+			if (!batch_operation) dmimg::error("--batch needs an operation");
+			if (!batchable) dmimg::error("--batch: the operation can't be run on every image (it compares or reads other files, writes other files or only prints)");
+			std::vector<std::pair<std::string, std::string>> files = dmimg::batch_files(batch_paths[0], batch_paths[1]);
+			dmimg::Batch_report report = dmimg::run_batch(files, [&](CImg<unsigned char>& image, CImg<unsigned char>& result) {
+				batch_input = &image;
+				batch_result = &result;
+				try {
+					batch_operation();
+				}
+				catch (...) {
+					batch_input = nullptr;
+					batch_result = nullptr;
+					throw;
+				}
+				batch_input = nullptr;
+				batch_result = nullptr;
+				return !result.is_empty();
+				});
+			const double thread_seconds = std::max(report.seconds * report.workers, 1e-9);
+			std::cout << "Batch: " << report.images << " images (" << report.failed << " failed, " << report.without_output << " without output) in "
+				<< report.seconds << " s, " << report.images / std::max(report.seconds, 1e-9) << " images/s" << std::endl;
+			std::cout << "Use of " << report.workers << " threads: decoding " << 100 * report.decoding_seconds / thread_seconds
+				<< "%, operation " << 100 * report.operation_seconds / thread_seconds << "%, encoding " << 100 * report.encoding_seconds / thread_seconds
+				<< "%, waiting " << std::max(0.0, 100 * (1 - (report.decoding_seconds + report.operation_seconds + report.encoding_seconds) / thread_seconds)) << "%" << std::endl;
+			if (report.failed > 0) exit_code = 4;
+		}
+		if (!fft_wisdom_file.empty()) dmimg::save_fft_wisdom(fft_wisdom_file);
 
 	}
 	catch (const CLI::ParseError & e) {
@@ -2143,7 +7320,7 @@ int main(int argc, char** argv) {
 		return 3;
 	}
 
-	return 0;
+	return exit_code;
 } //end ;)
 
 